@@ -0,0 +1,333 @@
+//
+// Created by IT-JIM
+// ASYNC_LOG: Leveled asynchronous logger, keeps cout off the bus and processing threads
+// Each thread writes fixed-size records into its own lock-free SPSC ring, one background thread prints them
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "clock_ns.h"
+#include "async_log.h"
+
+//======================================================================================================================
+/// Lock-free single producer (the owner thread) single consumer (the log thread) ring of records
+class LogRing {
+public:
+    /// Push a record, return false if the ring is full
+    bool push(const LogRecord &r) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == SIZE)
+            return false;
+        copyRecord(records[h % SIZE], r);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Pop a record, return false if the ring is empty
+    bool pop(LogRecord &r) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+            return false;
+        copyRecord(r, records[t % SIZE]);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+    }
+
+    /// Records dropped because the ring was full, written by the producer only
+    std::atomic<int64_t> countDropped{0};
+    /// The owner thread has exited, the ring is freed once it's empty
+    std::atomic_bool flagDead{false};
+
+private:
+    /// Copy only the used part of the data
+    static void copyRecord(LogRecord &dst, const LogRecord &src) {
+        dst.tNs = src.tNs;
+        dst.level = src.level;
+        dst.len = src.len;
+        memcpy(dst.data, src.data, src.len);
+    }
+
+    static constexpr uint32_t SIZE = 256;
+    LogRecord records[SIZE];
+    /// Next record to write (producer), next record to read (consumer)
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+};
+
+//======================================================================================================================
+/// The logger: the list of rings and the background thread
+/// Never destroyed (threads may still log during exit), the atexit() handler prints what's left
+class AsyncLog {
+public:
+    static AsyncLog &instance() {
+        static AsyncLog *log = new AsyncLog;
+        return *log;
+    }
+
+    /// The ring of the calling thread, created and registered on the first use
+    LogRing &ring() {
+        thread_local RingHolder holder;
+        if (!holder.ring) {
+            holder.ring = std::make_shared<LogRing>();
+            std::lock_guard<std::mutex> lock(mutex);
+            rings.push_back(holder.ring);
+        }
+        return *holder.ring;
+    }
+
+    /// A WARN or ERROR record which did not fit into the ring of its thread, rare, so a mutex is fine
+    void spill(const LogRecord &r) {
+        std::lock_guard<std::mutex> lock(mutexSpill);
+        spilled.push_back(r);
+    }
+
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        uint64_t gen = ++flushRequested;
+        condWake.notify_all();
+        condFlushed.wait(lock, [this, gen]{ return flushDone >= gen; });
+    }
+
+    std::atomic<int> level{(int) LogLevel::INFO};
+
+private:
+    /// Marks the ring dead when its thread exits
+    struct RingHolder {
+        std::shared_ptr<LogRing> ring;
+
+        ~RingHolder() {
+            if (ring)
+                ring->flagDead = true;
+        }
+    };
+
+    AsyncLog() {
+        thread = std::thread([this]{
+            codeThreadLog();
+        });
+        std::atexit([]{
+            AsyncLog::instance().flush();
+        });
+    }
+
+    /// Print all records from all rings, in the time order; return false if there were none
+    bool drain() {
+        std::vector<std::shared_ptr<LogRing>> current;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = rings;
+        }
+        batch.clear();
+        LogRecord r;
+        for (auto &ring : current) {
+            while (ring->pop(r))
+                batch.push_back(r);
+            int64_t dropped = ring->countDropped.exchange(0);
+            if (dropped > 0)
+                fprintf(stdout, "(log : %lld records dropped, ring full)\n", (long long) dropped);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutexSpill);
+            batch.insert(batch.end(), spilled.begin(), spilled.end());
+            spilled.clear();
+        }
+        std::stable_sort(batch.begin(), batch.end(),
+                         [](const LogRecord &a, const LogRecord &b) { return a.tNs < b.tNs; });
+        for (const LogRecord &rec : batch) {
+            size_t n = formatRecord(rec);
+            line[n] = '\n';
+            fwrite(line, 1, n + 1, stdout);
+        }
+        // One flush per batch instead of one per line
+        if (!batch.empty())
+            fflush(stdout);
+
+        // Free the rings of the threads which are gone
+        std::lock_guard<std::mutex> lock(mutex);
+        rings.erase(std::remove_if(rings.begin(), rings.end(), [](const std::shared_ptr<LogRing> &ring) {
+            return ring->flagDead && ring->empty();
+        }), rings.end());
+        return !batch.empty();
+    }
+
+    /// Format the arguments of a record into line, return the length
+    size_t formatRecord(const LogRecord &rec) {
+        size_t n = 0;
+        const uint8_t *p = rec.data, *end = rec.data + rec.len;
+        while (p < end) {
+            LogArg tag = LogArg(*p++);
+            if (tag == LogArg::TEXT) {
+                size_t len = *p++;
+                memcpy(line + n, p, len);
+                n += len;
+                p += len;
+                continue;
+            }
+            // Numbers: 8 bytes, always complete in the record
+            int k = 0;
+            if (tag == LogArg::INT) {
+                int64_t v;
+                memcpy(&v, p, 8);
+                k = snprintf(line + n, LINE_SIZE - n, "%lld", (long long) v);
+            } else if (tag == LogArg::UINT) {
+                uint64_t v;
+                memcpy(&v, p, 8);
+                k = snprintf(line + n, LINE_SIZE - n, "%llu", (unsigned long long) v);
+            } else {
+                double v;
+                memcpy(&v, p, 8);
+                k = snprintf(line + n, LINE_SIZE - n, "%g", v);
+            }
+            p += 8;
+            n += std::max(k, 0);
+        }
+        return n;
+    }
+
+    void codeThreadLog() {
+        for (;;) {
+            uint64_t gen;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                gen = flushRequested;
+            }
+            // Everything logged before the flush request is in the rings by now
+            drain();
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                flushDone = gen;
+                condFlushed.notify_all();
+                // Producers never notify us (that would need a lock), so we poll, unless somebody waits for a flush
+                condWake.wait_for(lock, std::chrono::milliseconds(5), [this]{ return flushRequested > flushDone; });
+            }
+        }
+    }
+
+    /// Protects rings and the flush counters
+    std::mutex mutex;
+    std::vector<std::shared_ptr<LogRing>> rings;
+    std::condition_variable condWake;
+    std::condition_variable condFlushed;
+    uint64_t flushRequested = 0;
+    uint64_t flushDone = 0;
+    /// Protects spilled
+    std::mutex mutexSpill;
+    std::vector<LogRecord> spilled;
+    /// Records of one drain and the formatted line, used by the log thread only
+    /// A number takes 9 bytes in a record and at most 24 characters formatted, so a line fits
+    static constexpr size_t LINE_SIZE = LogRecord::DATA_SIZE * 3;
+    std::vector<LogRecord> batch;
+    char line[LINE_SIZE + 1];
+    std::thread thread;
+};
+
+//======================================================================================================================
+void logSetLevel(LogLevel level) {
+    AsyncLog::instance().level = (int) level;
+}
+
+//======================================================================================================================
+bool logEnabled(LogLevel level) {
+    return (int) level >= AsyncLog::instance().level.load(std::memory_order_relaxed);
+}
+
+//======================================================================================================================
+bool logParseLevel(const std::string &s, LogLevel &level) {
+    if (s == "debug")
+        level = LogLevel::DEBUG;
+    else if (s == "info")
+        level = LogLevel::INFO;
+    else if (s == "warn")
+        level = LogLevel::WARN;
+    else if (s == "error")
+        level = LogLevel::ERROR;
+    else
+        return false;
+    return true;
+}
+
+//======================================================================================================================
+void logFlush() {
+    AsyncLog::instance().flush();
+}
+
+//======================================================================================================================
+LogLine::LogLine(LogLevel level) {
+    record.tNs = nowNs();
+    record.level = level;
+}
+
+//======================================================================================================================
+LogLine::~LogLine() {
+    AsyncLog &log = AsyncLog::instance();
+    LogRing &ring = log.ring();
+    if (ring.push(record))
+        return;
+    // Warnings and errors are never dropped
+    if (record.level >= LogLevel::WARN)
+        log.spill(record);
+    else
+        ++ring.countDropped;
+}
+
+//======================================================================================================================
+LogLine &LogLine::operator<<(const char *s) {
+    return appendText(s, s ? strlen(s) : 0);
+}
+
+//======================================================================================================================
+LogLine &LogLine::appendText(const char *s, size_t n) {
+    // In chunks of up to 255 characters, each with its tag and length byte
+    while (n > 0) {
+        int room = LogRecord::DATA_SIZE - record.len - 2;
+        if (room <= 0)
+            break;
+        size_t k = std::min(n, std::min(size_t(room), size_t(255)));
+        record.data[record.len] = uint8_t(LogArg::TEXT);
+        record.data[record.len + 1] = uint8_t(k);
+        memcpy(record.data + record.len + 2, s, k);
+        record.len += k + 2;
+        s += k;
+        n -= k;
+    }
+    return *this;
+}
+
+//======================================================================================================================
+template<typename T>
+LogLine &LogLine::appendNumber(LogArg tag, T v) {
+    static_assert(sizeof(T) == 8, "Numbers are stored in 8 bytes");
+    if (record.len + 1 + sizeof(T) > size_t(LogRecord::DATA_SIZE))
+        return *this;
+    record.data[record.len] = uint8_t(tag);
+    memcpy(record.data + record.len + 1, &v, sizeof(T));
+    record.len += 1 + sizeof(T);
+    return *this;
+}
+
+//======================================================================================================================
+LogLine &LogLine::operator<<(int v) { return appendNumber(LogArg::INT, int64_t(v)); }
+
+LogLine &LogLine::operator<<(unsigned v) { return appendNumber(LogArg::UINT, uint64_t(v)); }
+
+LogLine &LogLine::operator<<(long v) { return appendNumber(LogArg::INT, int64_t(v)); }
+
+LogLine &LogLine::operator<<(unsigned long v) { return appendNumber(LogArg::UINT, uint64_t(v)); }
+
+LogLine &LogLine::operator<<(long long v) { return appendNumber(LogArg::INT, int64_t(v)); }
+
+LogLine &LogLine::operator<<(unsigned long long v) { return appendNumber(LogArg::UINT, uint64_t(v)); }
+
+LogLine &LogLine::operator<<(double v) { return appendNumber(LogArg::DOUBLE, v); }
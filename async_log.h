@@ -0,0 +1,118 @@
+//
+// Created by IT-JIM
+// ASYNC_LOG: Leveled asynchronous logger, keeps cout off the bus and processing threads
+// Each thread writes fixed-size records into its own lock-free SPSC ring, one background thread prints them
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <ostream>
+
+//======================================================================================================================
+enum class LogLevel {
+    DEBUG = 0,
+    INFO,
+    WARN,
+    ERROR,
+};
+
+/// Set the runtime log level, records below it are skipped at the call site
+void logSetLevel(LogLevel level);
+
+bool logEnabled(LogLevel level);
+
+/// Parse "debug", "info", "warn" or "error", return false if unknown
+bool logParseLevel(const std::string &s, LogLevel &level);
+
+/// Block until everything logged so far (by any thread) is printed, e.g. before exit() or printing to cout
+void logFlush();
+
+//======================================================================================================================
+/// One log record: the raw << arguments of a single line, formatted by the log thread; truncated if too long
+/// data holds the arguments one after another: a LogArg tag, then the bytes of the value
+/// (TEXT: a length byte and the characters, the numbers: 8 bytes)
+struct LogRecord {
+    static constexpr int DATA_SIZE = 240;
+
+    int64_t tNs = 0;
+    LogLevel level = LogLevel::INFO;
+    uint16_t len = 0;
+    uint8_t data[DATA_SIZE];
+};
+
+/// The tags of the arguments in LogRecord::data
+enum class LogArg : uint8_t {
+    TEXT = 0,
+    INT,
+    UINT,
+    DOUBLE,
+};
+
+//======================================================================================================================
+/// One log line, built with << like cout, sent to the ring of this thread when destroyed
+/// The arguments are copied raw into the record, the log thread formats them, so the producer does no snprintf()
+/// Never blocks: if the ring is full, a DEBUG or INFO record is dropped (and counted),
+/// a WARN or ERROR one goes to a locked spill list instead, it is never lost
+/// Use it via the LOG_* macros
+class LogLine {
+public:
+    explicit LogLine(LogLevel level);
+
+    ~LogLine();
+
+    LogLine(const LogLine &) = delete;
+
+    LogLine &operator=(const LogLine &) = delete;
+
+    LogLine &operator<<(const char *s);
+
+    LogLine &operator<<(const std::string &s) { return appendText(s.data(), s.size()); }
+
+    LogLine &operator<<(char c) { return appendText(&c, 1); }
+
+    LogLine &operator<<(int v);
+
+    LogLine &operator<<(unsigned v);
+
+    LogLine &operator<<(long v);
+
+    LogLine &operator<<(unsigned long v);
+
+    LogLine &operator<<(long long v);
+
+    LogLine &operator<<(unsigned long long v);
+
+    LogLine &operator<<(double v);
+
+    /// std::endl and friends are ignored, each record is one line anyway
+    LogLine &operator<<(std::ostream &(*)(std::ostream &)) { return *this; }
+
+private:
+    LogLine &appendText(const char *s, size_t n);
+
+    /// Copy one number into the record, the log thread formats it
+    template<typename T>
+    LogLine &appendNumber(LogArg tag, T v);
+
+    LogRecord record;
+};
+
+//======================================================================================================================
+/// Turns the LOG_* expression into void, & binds looser than << (the glog trick, no dangling else)
+struct LogVoidify {
+    void operator&(const LogLine &) {}
+};
+
+/// Usage: LOG_INFO << prefix << "startFeed !";
+/// The arguments are not even evaluated when the level is disabled
+/// LOG_DEBUG compiles out completely unless BRIDGE_LOG_DEBUG is defined (cmake -DBRIDGE_LOG_DEBUG=ON)
+#define LOG_AT(level) !logEnabled(level) ? (void) 0 : LogVoidify() & LogLine(level)
+#ifdef BRIDGE_LOG_DEBUG
+#define LOG_DEBUG LOG_AT(LogLevel::DEBUG)
+#else
+#define LOG_DEBUG true ? (void) 0 : LogVoidify() & LogLine(LogLevel::DEBUG)
+#endif
+#define LOG_INFO LOG_AT(LogLevel::INFO)
+#define LOG_WARN LOG_AT(LogLevel::WARN)
+#define LOG_ERROR LOG_AT(LogLevel::ERROR)
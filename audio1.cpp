@@ -5,202 +5,42 @@
 
 #include <iostream>
 #include <string>
-#include <thread>
-#include <atomic>
-#include <cmath>
+#include <memory>
 
 #include <gst/gst.h>
-#include <gst/app/gstappsrc.h>
-#include <gst/app/gstappsink.h>
 
+#include "audio_dsp.h"
+#include "gstbridge.h"
 
 //======================================================================================================================
-/// A simple assertion function + macro
-inline void myAssert(bool b, const std::string &s = "MYASSERT ERROR !") {
-    if (!b)
-        throw std::runtime_error(s);
-}
-
-#define MY_ASSERT(x) myAssert(x, "MYASSERT ERROR :" #x)
-
-//======================================================================================================================
-/// Check GStreamer error, exit on error
-inline void checkErr(GError *err) {
-    if (err) {
-        std::cerr << "checkErr : " << err->message << std::endl;
-        exit(0);
+/// Process one audio sample from the goblin appsink, return the output buffer for the elf appsrc
+/// Takes ownership of the sample
+GstBuffer *processBufferA(BridgeStream &stream, GstSample *sample, AudioChain &dspChain, bool copyAudio) {
+    // Nothing to do with the audio: forward the buffer itself, the bridge costs almost nothing then
+    if (dspChain.empty() && !copyAudio) {
+        GstBuffer *buffer = forwardBuffer(sample);
+        LOG_DEBUG << "SAMPLE: bufferSize = " << gst_buffer_get_size(buffer);
+        ++stream.countForwarded;
+        return buffer;
     }
-}
-
-//======================================================================================================================
-/// Our global data
-struct GoblinData {
-    // The two pipelines
-    GstElement *goblinPipeline = nullptr;
-    GstElement *goblinSinkA = nullptr;
-    GstElement *elfPipeline = nullptr;
-    GstElement *elfSrcA = nullptr;
-
-    /// Appsrc flag: when it's true, send the frames, otherwise wait
-    std::atomic_bool flagRunA{false};
-    /// True if the elf pipeline has initialized and started splaying
-    std::atomic_bool flagElfStarted{false};
-};
-
-//======================================================================================================================
-/// Process a single bus message, log messages, exit on error, return false on eof
-static bool busProcessMsg(GstElement *pipeline, GstMessage *msg, const std::string &prefix) {
-    using namespace std;
-
-    GstMessageType mType = GST_MESSAGE_TYPE(msg);
-    cout << "[" << prefix << "] : mType = " << mType << " ";
-    switch (mType) {
-        case (GST_MESSAGE_ERROR):
-            // Parse error and exit program, hard exit
-            GError *err;
-            gchar *dbg;
-            gst_message_parse_error(msg, &err, &dbg);
-            cout << "ERR = " << err->message << " FROM " << GST_OBJECT_NAME(msg->src) << endl;
-            cout << "DBG = " << dbg << endl;
-            g_clear_error(&err);
-            g_free(dbg);
-            exit(1);
-        case (GST_MESSAGE_EOS) :
-            // Soft exit on EOS
-            cout << " EOS !" << endl;
-            return false;
-        case (GST_MESSAGE_STATE_CHANGED):
-            // Parse state change, print extra info for pipeline only
-            cout << "State changed !" << endl;
-            if (GST_MESSAGE_SRC(msg) == GST_OBJECT(pipeline)) {
-                GstState sOld, sNew, sPenging;
-                gst_message_parse_state_changed(msg, &sOld, &sNew, &sPenging);
-                cout << "Pipeline changed from " << gst_element_state_get_name(sOld) << " to " <<
-                     gst_element_state_get_name(sNew) << endl;
-            }
-            break;
-        case (GST_MESSAGE_STEP_START):
-            cout << "STEP START !" << endl;
-            break;
-        case (GST_MESSAGE_STREAM_STATUS):
-            cout << "STREAM STATUS !" << endl;
-            break;
-        case (GST_MESSAGE_ELEMENT):
-            cout << "MESSAGE ELEMENT !" << endl;
-            break;
 
-            // You can add more stuff here if you want
-
-        default:
-            cout << endl;
-    }
-    return true;
-}
-
-//======================================================================================================================
-/// Run the message loop for one bus
-void codeThreadBus(GstElement *pipeline, GoblinData &data, const std::string &prefix) {
-    using namespace std;
-    GstBus *bus = gst_element_get_bus(pipeline);
-
-    int res;
-    while (true) {
-        GstMessage *msg = gst_bus_timed_pop(bus, GST_CLOCK_TIME_NONE);
-        MY_ASSERT(msg);
-        res = busProcessMsg(pipeline, msg, prefix);
-        gst_message_unref(msg);
-        if (!res)
-            break;
-    }
-    gst_object_unref(bus);
-    cout << "BUS THREAD FINISHED : " << prefix << endl;
-}
-
-//======================================================================================================================
-/// Callback called when the pipeline wants more data
-static void startFeed(GstElement *source, guint size, GoblinData *data) {
-    using namespace std;
-    if (!data->flagRunA) {
-        cout << "startFeed !" << endl;
-        data->flagRunA = true;
+    // With --copy and without DSP stages, we simply copy the input buffer to the output
+    if (dspChain.empty()) {
+        GstBuffer *buffer = copyBuffer(stream, sample);
+        LOG_DEBUG << "SAMPLE: bufferSize = " << gst_buffer_get_size(buffer);
+        return buffer;
     }
-}
 
-//======================================================================================================================
-/// Callback called when the pipeline wants no more data for now
-static void stopFeed(GstElement *source, GoblinData *data) {
-    using namespace std;
-    if (data->flagRunA) {
-        cout << "stopFeed !" << endl;
-        data->flagRunA = false;
-    }
+    // In-place DSP, like video3 --inplace: the very same buffer goes to elfSrc, with all timestamps
+    GstBuffer *buffer = writableBuffer(stream, sample);
+    GstMapInfo map;
+    MY_ASSERT(gst_buffer_map(buffer, &map, GST_MAP_READWRITE));
+    int64_t dspNs = dspChain.process((int16_t *) map.data, map.size / sizeof(int16_t));
+    LOG_DEBUG << "SAMPLE: bufferSize = " << map.size << ", dsp = " << dspNs * 1e-3 << " us";
+    gst_buffer_unmap(buffer, &map);
+    return buffer;
 }
-//======================================================================================================================
-/// Process audio
-void codeThreadProcessA(GoblinData &data) {
-    using namespace std;
-    for(;;) {
-        // We wait until ELF wants data, but only if ELF is already started
-        while (data.flagElfStarted && !data.flagRunA) {
-            cout << "(wait)" << endl;
-            this_thread::sleep_for(std::chrono::milliseconds(10));
-        }
-
-        // Check for Goblin EOS
-        if (gst_app_sink_is_eos(GST_APP_SINK(data.goblinSinkA))) {
-            cout << "GOBLIN EOS !" << endl;
-            break;
-        }
-
-        // Pull the sample from Goblin appsink
-        GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(data.goblinSinkA));
-        if (sample == nullptr) {
-            cout << "NO sample !" << endl;
-            break;
-        }
-
-        // Check if ELF is initialized
-        if (!data.flagElfStarted) {
-            // Use sample caps verbatim to ELF appsrc and re-negotiate
-            //            // Make a copy to be safe (probably not needed)
-            GstCaps *caps = gst_sample_get_caps(sample);
-            MY_ASSERT(caps != nullptr);
-            GstCaps *capsElf = gst_caps_copy(caps);
-
-            g_object_set(data.elfSrcA, "caps", capsElf, nullptr);
-            gst_caps_unref(capsElf);
-
-            // Start the elf pipeline
-            GstStateChangeReturn ret = gst_element_set_state(data.elfPipeline, GST_STATE_PLAYING);
-            MY_ASSERT(ret != GST_STATE_CHANGE_FAILURE);
-            data.flagElfStarted = true;
-        }
 
-        // Process sample
-        GstBuffer *bufferIn = gst_sample_get_buffer(sample);
-        GstMapInfo mapIn;
-        MY_ASSERT(gst_buffer_map(bufferIn, &mapIn, GST_MAP_READ));
-
-        // Create the output bufer and send it to elfSrc
-        // Here we simply copy the input buffer to the output
-        // If needed, some sound processing on the raw audio waveform can be put in the middle
-        int bufferSize = mapIn.size;
-        cout << "SAMPLE: bufferSize = " << mapIn.size << endl;
-        GstBuffer *bufferOut = gst_buffer_new_and_alloc(bufferSize);
-        GstMapInfo mapOut;
-        gst_buffer_map(bufferOut, &mapOut, GST_MAP_WRITE);
-        memcpy(mapOut.data, mapIn.data, bufferSize);
-        gst_buffer_unmap(bufferIn, &mapIn);
-        gst_buffer_unmap(bufferOut, &mapOut);
-        // Copy the input packet timestamp and duration
-        bufferOut->pts = bufferIn->pts;
-        bufferOut->duration = bufferIn->duration;
-        GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(data.elfSrcA), bufferOut);
-
-        gst_sample_unref(sample);
-    }
-    gst_app_src_end_of_stream(GST_APP_SRC(data.elfSrcA));
-}
 //======================================================================================================================
 int main(int argc, char **argv) {
     using namespace std;
@@ -209,65 +49,97 @@ int main(int argc, char **argv) {
     // Init gstreamer
     gst_init(&argc, &argv);
 
-    if (argc != 2) {
-        cout << "Usage:\naudio1 <audio_file>" << endl;
+    if (argc < 2) {
+        cout << "Usage:\naudio1 <audio_file> [--copy] [--gain <dB>] [--eq <freq>:<q>:<dB>] [--limit <dB>]"
+                " [--remap <c0>,<c1>,...] [--out <file>] [bridge options]" << endl;
+        cout << "  --copy : copy audio buffers instead of forwarding them by reference (old behavior, for comparison)" << endl;
+        cout << "  --out <file> : encode to a file as fast as possible instead of playing, .ogg (Vorbis) or .wav" << endl;
+        cout << "  DSP stages, applied in-place in the command line order, can be repeated :" << endl;
+        cout << "  --gain <dB> : gain, saturating, at most +18 dB" << endl;
+        cout << "  --eq <freq>:<q>:<dB> : peaking EQ biquad, e.g. --eq 1000:0.7:-6" << endl;
+        cout << "  --limit <dB> : peak limiter with the ceiling in dBFS, e.g. --limit -1" << endl;
+        cout << "  --remap <c0>,<c1>,... : output channel i = input channel ci, e.g. --remap 1,0 swaps stereo;" << endl;
+        cout << "      a stream with another number of channels passes unchanged" << endl;
+        printBridgeUsage();
         return 0;
     }
     string fileName(argv[1]);
     cout << "Playing file : " << fileName << endl;
 
-    // Our global data
-    GoblinData data;
+    BridgeOptions opts;
+    AudioChain dspChain;
+    bool copyAudio = false;
+    string outFile;
+    for (int i = 2; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "--out" && i + 1 < argc)
+            outFile = argv[++i];
+        else if (arg == "--copy")
+            copyAudio = true;
+        else if ((arg == "--gain" || arg == "--eq" || arg == "--limit" || arg == "--remap") && i + 1 < argc) {
+            string error;
+            unique_ptr<AudioStage> stage = parseAudioStage(arg, argv[++i], error);
+            if (stage)
+                dspChain.add(move(stage));
+            else
+                cout << "Bad value for " << arg << " : " << argv[i] << ", " << error << endl;
+        } else if (!parseBridgeOption(opts, i, argc, argv))
+            cout << "Unknown option : " << arg << endl;
+    }
+    // The DSP stages keep state between buffers (filters, envelopes), they must see the buffers in order
+    if (opts.numWorkers > 0) {
+        cout << "--workers is not supported for audio, ignored" << endl;
+        opts.numWorkers = 0;
+    }
+    // Only the copy mode needs the pool
+    if (!copyAudio || !dspChain.empty())
+        opts.poolSize = 0;
+
+    if (!dspChain.empty())
+        cout << "DSP chain : " << dspChain.describe() << endl;
 
     // Set up GOBLIN (input) pipeline
     // Here we force the int16 interleaved format, but do not specify the sample rate
+    // enable-last-sample=false : appsink must not keep an extra reference to the buffer we process in-place
+    // Writing to a file, nothing is synced to the clock : decode, process and encode as fast as possible
+    string sync = outFile.empty() ? "1" : "false";
     string pipeStrGoblin = "filesrc location=" + fileName +
-                           " ! decodebin ! audioconvert ! appsink name=goblin_sink max-buffers=2 sync=1 caps=audio/x-raw,format=S16LE,layout=interleaved";
-    GError *err = nullptr;
-    data.goblinPipeline = gst_parse_launch(pipeStrGoblin.c_str(), &err);
-    checkErr(err);
-    MY_ASSERT(data.goblinPipeline);
-    data.goblinSinkA = gst_bin_get_by_name(GST_BIN (data.goblinPipeline), "goblin_sink");
-    MY_ASSERT(data.goblinSinkA);
+                           " ! decodebin ! audioconvert ! appsink name=goblin_sink max-buffers=2 sync=" + sync +
+                           " enable-last-sample=false caps=audio/x-raw,format=S16LE,layout=interleaved";
 
     // Set up ELF (output pipeline)
     // Note that appsrc does not have full caps yet as usual
     // format=time is vital for audio for some reason
-    string pipeStrElf = "appsrc name=elf_src format=time caps=audio/x-raw,format=S16LE,layout=interleaved ! audioconvert ! audioresample ! autoaudiosink sync=1";
-    data.elfPipeline = gst_parse_launch(pipeStrElf.c_str(), &err);
-    checkErr(err);
-    MY_ASSERT(data.elfPipeline);
-    data.elfSrcA = gst_bin_get_by_name(GST_BIN (data.elfPipeline), "elf_src");
-    MY_ASSERT(data.elfSrcA);
-    // Add calbacks like in video2
-    g_signal_connect(data.elfSrcA, "need-data", G_CALLBACK(startFeed), &data);
-    g_signal_connect(data.elfSrcA, "enough-data", G_CALLBACK(stopFeed), &data);
-
-    // Play the Goblin pipeline only (Elf will start a bit later)
-    MY_ASSERT(gst_element_set_state(data.goblinPipeline, GST_STATE_PLAYING));
-
-    // Audio processing thread (from goblin appsink to elf appsrc)
-    thread threadProcessA([&data]{
-        codeThreadProcessA(data);
-    });
-    // Now we need two bus threads: one for each pipeline !
-    thread threadBusGoblin([&data]{
-        codeThreadBus(data.goblinPipeline, data, "GOBLIN");
-    });
-    thread threadBusElf([&data]{
-        codeThreadBus(data.elfPipeline, data, "ELF");
-    });
-
-    // Wait for threads
-    threadProcessA.join();
-    threadBusGoblin.join();
-    threadBusElf.join();
-
-    // Destroy the two pipelines
-    gst_element_set_state(data.goblinPipeline, GST_STATE_NULL);
-    gst_object_unref(data.goblinPipeline);
-    gst_element_set_state(data.elfPipeline, GST_STATE_NULL);
-    gst_object_unref(data.elfPipeline);
+    string pipeStrElf = "appsrc name=elf_src format=time caps=audio/x-raw,format=S16LE,layout=interleaved ! " + (outFile.empty() ?
+                        string("audioconvert ! audioresample ! autoaudiosink name=elf_sink sync=1") : elfFileBranchAudio(outFile, "elf_sink"));
+
+    BridgeEngine engine(pipeStrGoblin, pipeStrElf);
+    BridgeStream &streamA = engine.addStream(opts, "goblin_sink", "elf_src", "elf_sink");
+    // Audio buffers vary in size, so leave some margin in the pool buffers
+    streamA.poolMargin = 2;
+    // The DSP chain needs the number of channels and the sample rate
+    streamA.init = [&dspChain](BridgeStream &stream, GstSample *sample) {
+        if (dspChain.empty())
+            return;
+        GstStructure *s = gst_caps_get_structure(gst_sample_get_caps(sample), 0);
+        int channels, rate;
+        MY_ASSERT(gst_structure_get_int(s, "channels", &channels));
+        MY_ASSERT(gst_structure_get_int(s, "rate", &rate));
+        dspChain.configure(channels, rate);
+    };
+    streamA.process = [&dspChain, copyAudio](BridgeStream &stream, GstSample *sample) {
+        return processBufferA(stream, sample, dspChain, copyAudio);
+    };
+
+    // Play, process until EOS on both pipelines
+    engine.run();
+    engine.printStats();
+
+    const AudioChain &chain = dspChain;
+    if (chain.countBuffers > 0)
+        cout << "DSP " << chain.describe() << " : " << chain.channels << " channels, " << chain.rate << " Hz, buffers = " <<
+             chain.countBuffers << ", average = " << chain.sumNs * 1e-3 / chain.countBuffers << " us, max = " <<
+             chain.maxNs * 1e-3 << " us" << endl;
 
     return 0;
 }
@@ -0,0 +1,516 @@
+//
+// Created by IT-JIM
+// AUDIO_DSP: In-place DSP stages for S16LE interleaved audio (gain, biquad EQ, limiter, channel remap)
+
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+
+#include "clock_ns.h"
+#include "audio_dsp.h"
+#include "async_log.h"
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AUDIO_DSP_X86 1
+#include <immintrin.h>
+#endif
+
+//======================================================================================================================
+// SIMD sample kernels, dispatched like kernelInvert(), see kernels.h
+//======================================================================================================================
+/// Multiply n samples by a Q12 gain, round and saturate to int16
+static void gainQ12Scalar(int16_t *p, size_t n, int16_t g) {
+    for (size_t i = 0; i < n; ++i) {
+        int32_t v = (int32_t(p[i]) * g + 2048) >> 12;
+        p[i] = int16_t(std::min(std::max(v, -32768), 32767));
+    }
+}
+
+/// Clip n samples to [-c, c]
+static void clipScalar(int16_t *p, size_t n, int16_t c) {
+    for (size_t i = 0; i < n; ++i)
+        p[i] = std::min(std::max(p[i], int16_t(-c)), c);
+}
+
+/// The largest absolute value of n samples, 32768 for -32768
+static int peakScalar(const int16_t *p, size_t n) {
+    int peak = 0;
+    for (size_t i = 0; i < n; ++i)
+        peak = std::max(peak, std::abs(int(p[i])));
+    return peak;
+}
+
+/// Round and saturate a float sample to int16
+/// Clamping in int32 (not in float) keeps it branchless, so that the loops using it vectorize
+/// The float is always far below 2^31 here: int16 input times a gain of at most a few hundred
+static inline int16_t toS16(float v) {
+    int32_t i = int32_t(v + std::copysign(0.5f, v));
+    return int16_t(std::min(std::max(i, -32768), 32767));
+}
+
+/// A tiny offset keeps the biquad state out of the (very slow) denormal range on silence
+static const float ANTI_DENORMAL = 1e-20f;
+
+/// Biquad (transposed direct form II) on the channels c0 ... channels - 1 of numFrames interleaved frames
+/// k = b0, b1, b2, a1, a2; s1, s2 = the state of each channel
+static void biquadScalarFrom(int16_t *samples, size_t numFrames, int channels, int c0, const float *k,
+                             float *s1, float *s2) {
+    for (int c = c0; c < channels; ++c) {
+        float z1 = s1[c], z2 = s2[c];
+        int16_t *p = samples + c;
+        for (size_t f = 0; f < numFrames; ++f, p += channels) {
+            float x = float(*p) + ANTI_DENORMAL;
+            float y = k[0] * x + z1;
+            z1 = k[1] * x - k[3] * y + z2;
+            z2 = k[2] * x - k[4] * y;
+            *p = toS16(y);
+        }
+        s1[c] = z1;
+        s2[c] = z2;
+    }
+}
+
+static void biquadScalar(int16_t *samples, size_t numFrames, int channels, const float *k, float *s1, float *s2) {
+    biquadScalarFrom(samples, numFrames, channels, 0, k, s1, s2);
+}
+
+#ifdef AUDIO_DSP_X86
+//======================================================================================================================
+__attribute__((target("sse2")))
+static void gainQ12Sse2(int16_t *p, size_t n, int16_t g) {
+    const __m128i vg = _mm_set1_epi16(g);
+    const __m128i round = _mm_set1_epi32(2048);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (p + i));
+        // Full 32-bit products from the low and high halves
+        __m128i lo = _mm_mullo_epi16(x, vg);
+        __m128i hi = _mm_mulhi_epi16(x, vg);
+        __m128i p0 = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(lo, hi), round), 12);
+        __m128i p1 = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(lo, hi), round), 12);
+        // packs saturates to int16
+        _mm_storeu_si128((__m128i *) (p + i), _mm_packs_epi32(p0, p1));
+    }
+    gainQ12Scalar(p + i, n - i, g);
+}
+
+__attribute__((target("sse2")))
+static void clipSse2(int16_t *p, size_t n, int16_t c) {
+    const __m128i vmax = _mm_set1_epi16(c);
+    const __m128i vmin = _mm_set1_epi16(-c);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (p + i));
+        _mm_storeu_si128((__m128i *) (p + i), _mm_min_epi16(_mm_max_epi16(x, vmin), vmax));
+    }
+    clipScalar(p + i, n - i, c);
+}
+
+__attribute__((target("sse2")))
+static int peakSse2(const int16_t *p, size_t n) {
+    __m128i vmax = _mm_setzero_si128(), vmin = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (p + i));
+        vmax = _mm_max_epi16(vmax, x);
+        vmin = _mm_min_epi16(vmin, x);
+    }
+    alignas(16) int16_t hi[8], lo[8];
+    _mm_store_si128((__m128i *) hi, vmax);
+    _mm_store_si128((__m128i *) lo, vmin);
+    int peak = peakScalar(p + i, n - i);
+    for (int j = 0; j < 8; ++j)
+        peak = std::max(peak, std::max(int(hi[j]), -int(lo[j])));
+    return peak;
+}
+
+/// 4 channels at a time, in the channel order from c0, the rest is scalar
+__attribute__((target("sse2")))
+static void biquadSse2From(int16_t *samples, size_t numFrames, int channels, int c0, const float *k,
+                           float *s1, float *s2) {
+    const __m128 b0 = _mm_set1_ps(k[0]), b1 = _mm_set1_ps(k[1]), b2 = _mm_set1_ps(k[2]);
+    const __m128 a1 = _mm_set1_ps(k[3]), a2 = _mm_set1_ps(k[4]);
+    const __m128 offset = _mm_set1_ps(ANTI_DENORMAL);
+    const __m128 half = _mm_set1_ps(0.5f), signMask = _mm_set1_ps(-0.0f);
+    int c = c0;
+    for (; c + 4 <= channels; c += 4) {
+        __m128 z1 = _mm_loadu_ps(s1 + c), z2 = _mm_loadu_ps(s2 + c);
+        int16_t *p = samples + c;
+        for (size_t f = 0; f < numFrames; ++f, p += channels) {
+            // 4 samples, sign-extended to int32, to float
+            __m128i xi = _mm_loadl_epi64((const __m128i *) p);
+            __m128 x = _mm_add_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(xi, xi), 16)), offset);
+            __m128 y = _mm_add_ps(_mm_mul_ps(b0, x), z1);
+            z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), z2);
+            z2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+            // Round half away from zero like toS16(), packs saturates to int16
+            __m128i yi = _mm_cvttps_epi32(_mm_add_ps(y, _mm_or_ps(_mm_and_ps(y, signMask), half)));
+            _mm_storel_epi64((__m128i *) p, _mm_packs_epi32(yi, yi));
+        }
+        _mm_storeu_ps(s1 + c, z1);
+        _mm_storeu_ps(s2 + c, z2);
+    }
+    biquadScalarFrom(samples, numFrames, channels, c, k, s1, s2);
+}
+
+__attribute__((target("sse2")))
+static void biquadSse2(int16_t *samples, size_t numFrames, int channels, const float *k, float *s1, float *s2) {
+    biquadSse2From(samples, numFrames, channels, 0, k, s1, s2);
+}
+
+//======================================================================================================================
+__attribute__((target("avx2")))
+static void gainQ12Avx2(int16_t *p, size_t n, int16_t g) {
+    const __m256i vg = _mm256_set1_epi16(g);
+    const __m256i round = _mm256_set1_epi32(2048);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (p + i));
+        __m256i lo = _mm256_mullo_epi16(x, vg);
+        __m256i hi = _mm256_mulhi_epi16(x, vg);
+        // unpack and packs both work within 128-bit lanes, so the sample order is preserved
+        __m256i p0 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_unpacklo_epi16(lo, hi), round), 12);
+        __m256i p1 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_unpackhi_epi16(lo, hi), round), 12);
+        _mm256_storeu_si256((__m256i *) (p + i), _mm256_packs_epi32(p0, p1));
+    }
+    gainQ12Scalar(p + i, n - i, g);
+}
+
+__attribute__((target("avx2")))
+static void clipAvx2(int16_t *p, size_t n, int16_t c) {
+    const __m256i vmax = _mm256_set1_epi16(c);
+    const __m256i vmin = _mm256_set1_epi16(-c);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (p + i));
+        _mm256_storeu_si256((__m256i *) (p + i), _mm256_min_epi16(_mm256_max_epi16(x, vmin), vmax));
+    }
+    clipScalar(p + i, n - i, c);
+}
+
+__attribute__((target("avx2")))
+static int peakAvx2(const int16_t *p, size_t n) {
+    __m256i vmax = _mm256_setzero_si256(), vmin = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (p + i));
+        vmax = _mm256_max_epi16(vmax, x);
+        vmin = _mm256_min_epi16(vmin, x);
+    }
+    alignas(32) int16_t hi[16], lo[16];
+    _mm256_store_si256((__m256i *) hi, vmax);
+    _mm256_store_si256((__m256i *) lo, vmin);
+    int peak = peakScalar(p + i, n - i);
+    for (int j = 0; j < 16; ++j)
+        peak = std::max(peak, std::max(int(hi[j]), -int(lo[j])));
+    return peak;
+}
+
+/// 8 channels at a time, then 4 with SSE2, the rest is scalar
+__attribute__((target("avx2")))
+static void biquadAvx2(int16_t *samples, size_t numFrames, int channels, const float *k, float *s1, float *s2) {
+    const __m256 b0 = _mm256_set1_ps(k[0]), b1 = _mm256_set1_ps(k[1]), b2 = _mm256_set1_ps(k[2]);
+    const __m256 a1 = _mm256_set1_ps(k[3]), a2 = _mm256_set1_ps(k[4]);
+    const __m256 offset = _mm256_set1_ps(ANTI_DENORMAL);
+    const __m256 half = _mm256_set1_ps(0.5f), signMask = _mm256_set1_ps(-0.0f);
+    int c = 0;
+    for (; c + 8 <= channels; c += 8) {
+        __m256 z1 = _mm256_loadu_ps(s1 + c), z2 = _mm256_loadu_ps(s2 + c);
+        int16_t *p = samples + c;
+        for (size_t f = 0; f < numFrames; ++f, p += channels) {
+            __m128i xi = _mm_loadu_si128((const __m128i *) p);
+            __m256 x = _mm256_add_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(xi)), offset);
+            __m256 y = _mm256_add_ps(_mm256_mul_ps(b0, x), z1);
+            z1 = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(b1, x), _mm256_mul_ps(a1, y)), z2);
+            z2 = _mm256_sub_ps(_mm256_mul_ps(b2, x), _mm256_mul_ps(a2, y));
+            __m256i yi = _mm256_cvttps_epi32(_mm256_add_ps(y, _mm256_or_ps(_mm256_and_ps(y, signMask), half)));
+            // Pack the two 128-bit halves, _mm256_packs_epi32 would interleave the lanes
+            _mm_storeu_si128((__m128i *) p, _mm_packs_epi32(_mm256_castsi256_si128(yi), _mm256_extracti128_si256(yi, 1)));
+        }
+        _mm256_storeu_ps(s1 + c, z1);
+        _mm256_storeu_ps(s2 + c, z2);
+    }
+    biquadSse2From(samples, numFrames, channels, c, k, s1, s2);
+}
+#endif
+
+//======================================================================================================================
+typedef void (*SampleFn)(int16_t *, size_t, int16_t);
+
+static const KernelTable<SampleFn> &gainTable() {
+    static const KernelTable<SampleFn> table = [] {
+        KernelTable<SampleFn> t;
+        t.impl[(int) SimdLevel::SCALAR] = gainQ12Scalar;
+#ifdef AUDIO_DSP_X86
+        t.impl[(int) SimdLevel::SSE2] = gainQ12Sse2;
+        t.impl[(int) SimdLevel::AVX2] = gainQ12Avx2;
+#endif
+        return t;
+    }();
+    return table;
+}
+
+static const KernelTable<SampleFn> &clipTable() {
+    static const KernelTable<SampleFn> table = [] {
+        KernelTable<SampleFn> t;
+        t.impl[(int) SimdLevel::SCALAR] = clipScalar;
+#ifdef AUDIO_DSP_X86
+        t.impl[(int) SimdLevel::SSE2] = clipSse2;
+        t.impl[(int) SimdLevel::AVX2] = clipAvx2;
+#endif
+        return t;
+    }();
+    return table;
+}
+
+typedef int (*PeakFn)(const int16_t *, size_t);
+
+static const KernelTable<PeakFn> &peakTable() {
+    static const KernelTable<PeakFn> table = [] {
+        KernelTable<PeakFn> t;
+        t.impl[(int) SimdLevel::SCALAR] = peakScalar;
+#ifdef AUDIO_DSP_X86
+        t.impl[(int) SimdLevel::SSE2] = peakSse2;
+        t.impl[(int) SimdLevel::AVX2] = peakAvx2;
+#endif
+        return t;
+    }();
+    return table;
+}
+
+typedef void (*BiquadFn)(int16_t *, size_t, int, const float *, float *, float *);
+
+static const KernelTable<BiquadFn> &biquadTable() {
+    static const KernelTable<BiquadFn> table = [] {
+        KernelTable<BiquadFn> t;
+        t.impl[(int) SimdLevel::SCALAR] = biquadScalar;
+#ifdef AUDIO_DSP_X86
+        t.impl[(int) SimdLevel::SSE2] = biquadSse2;
+        t.impl[(int) SimdLevel::AVX2] = biquadAvx2;
+#endif
+        return t;
+    }();
+    return table;
+}
+
+//======================================================================================================================
+/// dB to linear amplitude
+static double dbToLin(double db) {
+    return std::pow(10.0, db / 20);
+}
+
+//======================================================================================================================
+AudioGain::AudioGain(double gainDb) : gainDb(gainDb) {
+    double g = std::round(dbToLin(gainDb) * 4096);
+    gainQ12 = int16_t(std::min(g, 32767.0));
+}
+
+void AudioGain::configure(int channels, int /*rate*/) {
+    this->channels = channels;
+}
+
+void AudioGain::process(int16_t *samples, size_t numFrames) {
+    gainTable().select()(samples, numFrames * channels, gainQ12);
+}
+
+std::string AudioGain::name() const {
+    std::ostringstream oss;
+    oss << "gain(" << gainDb << " dB)";
+    return oss.str();
+}
+
+//======================================================================================================================
+AudioBiquad::AudioBiquad(double freq, double q, double gainDb) : freq(freq), q(q), gainDb(gainDb) {}
+
+void AudioBiquad::configure(int channels, int rate) {
+    this->channels = channels;
+    z1.assign(channels, 0);
+    z2.assign(channels, 0);
+    // At or above Nyquist sin(w0) goes negative, and so does alpha: the filter can go unstable, so bypass it
+    // The rate is known only here, the option parser cannot check it
+    bypass = freq >= rate / 2.0;
+    if (bypass) {
+        LOG_WARN << "EQ " << freq << " Hz is at or above Nyquist for " << rate << " Hz, bypassed";
+        return;
+    }
+
+    // RBJ audio EQ cookbook, peaking EQ
+    double a = std::pow(10.0, gainDb / 40);
+    double w0 = 2 * M_PI * freq / rate;
+    double alpha = std::sin(w0) / (2 * q);
+    double a0 = 1 + alpha / a;
+    b0 = float((1 + alpha * a) / a0);
+    b1 = float(-2 * std::cos(w0) / a0);
+    b2 = float((1 - alpha * a) / a0);
+    a1 = float(-2 * std::cos(w0) / a0);
+    a2 = float((1 - alpha / a) / a0);
+}
+
+void AudioBiquad::process(int16_t *samples, size_t numFrames) {
+    if (bypass)
+        return;
+    const float k[5] = {b0, b1, b2, a1, a2};
+    biquadTable().select()(samples, numFrames, channels, k, z1.data(), z2.data());
+}
+
+std::string AudioBiquad::name() const {
+    std::ostringstream oss;
+    oss << "eq(" << freq << " Hz, Q " << q << ", " << gainDb << " dB" << (bypass ? ", bypassed" : "") << ")";
+    return oss.str();
+}
+
+//======================================================================================================================
+AudioLimiter::AudioLimiter(double ceilingDb, double releaseMs) : ceilingDb(ceilingDb), releaseMs(releaseMs) {
+    ceiling = int16_t(std::min(std::round(dbToLin(ceilingDb) * 32767), 32767.0));
+}
+
+void AudioLimiter::configure(int channels, int rate) {
+    this->channels = channels;
+    gain = 1;
+    // The gain returns to 1 with the time constant releaseMs
+    release = float(1 - std::exp(-1000.0 / (releaseMs * rate)));
+}
+
+void AudioLimiter::process(int16_t *samples, size_t numFrames) {
+    // Fully released and nothing above the ceiling: the gain stays 1 and no sample changes, skip the envelope
+    if (gain == 1 && peakTable().select()(samples, numFrames * channels) <= ceiling)
+        return;
+    for (size_t f = 0; f < numFrames; ++f) {
+        int16_t *frame = samples + f * channels;
+        int peak = 0;
+        for (int c = 0; c < channels; ++c)
+            peak = std::max(peak, std::abs(int(frame[c])));
+        // Instant attack, exponential release
+        float g = gain + (1 - gain) * release;
+        if (peak * g > ceiling)
+            g = float(ceiling) / peak;
+        gain = g;
+        if (g < 1)
+            for (int c = 0; c < channels; ++c)
+                frame[c] = toS16(frame[c] * g);
+    }
+    // Rounding can still overshoot by one, the clip takes care of it
+    clipTable().select()(samples, numFrames * channels, ceiling);
+}
+
+std::string AudioLimiter::name() const {
+    std::ostringstream oss;
+    oss << "limiter(" << ceilingDb << " dB)";
+    return oss.str();
+}
+
+//======================================================================================================================
+AudioRemap::AudioRemap(const std::vector<int> &map) : map(map) {}
+
+void AudioRemap::configure(int channels, int /*rate*/) {
+    // Caps go to ELF verbatim, so we cannot change the number of channels; this runs on the processing thread,
+    // so a stream which does not match the map is passed through, name() tells
+    this->channels = channels;
+    frame.resize(map.size());
+}
+
+void AudioRemap::process(int16_t *samples, size_t numFrames) {
+    size_t channels = map.size();
+    if ((int) channels != this->channels)
+        return;
+    for (size_t f = 0; f < numFrames; ++f) {
+        int16_t *p = samples + f * channels;
+        memcpy(frame.data(), p, channels * sizeof(int16_t));
+        for (size_t c = 0; c < channels; ++c)
+            p[c] = frame[map[c]];
+    }
+}
+
+std::string AudioRemap::name() const {
+    std::ostringstream oss;
+    oss << "remap(";
+    for (size_t i = 0; i < map.size(); ++i)
+        oss << (i ? "," : "") << map[i];
+    if (channels > 0 && channels != (int) map.size())
+        oss << ", passthrough : " << channels << " channels";
+    oss << ")";
+    return oss.str();
+}
+
+//======================================================================================================================
+void AudioChain::add(std::unique_ptr<AudioStage> stage) {
+    stages.push_back(std::move(stage));
+    // Force reconfiguration
+    channels = rate = 0;
+}
+
+void AudioChain::configure(int channels, int rate) {
+    if (channels == this->channels && rate == this->rate)
+        return;
+    this->channels = channels;
+    this->rate = rate;
+    for (auto &stage : stages)
+        stage->configure(channels, rate);
+}
+
+int64_t AudioChain::process(int16_t *samples, size_t numSamples) {
+    int64_t t0 = nowNs();
+    size_t numFrames = numSamples / channels;
+    for (auto &stage : stages)
+        stage->process(samples, numFrames);
+    int64_t dt = nowNs() - t0;
+    ++countBuffers;
+    sumNs += dt;
+    maxNs = std::max(maxNs, dt);
+    return dt;
+}
+
+std::string AudioChain::describe() const {
+    std::string s;
+    for (auto &stage : stages)
+        s += (s.empty() ? "" : " -> ") + stage->name();
+    return s;
+}
+
+//======================================================================================================================
+std::unique_ptr<AudioStage> parseAudioStage(const std::string &option, const std::string &value, std::string &error) {
+    using namespace std;
+    // Split "a:b:c" or "a,b,c" into numbers
+    vector<double> v;
+    string tok;
+    istringstream iss(value);
+    while (getline(iss, tok, option == "--remap" ? ',' : ':')) {
+        try {
+            v.push_back(stod(tok));
+        } catch (const exception &) {
+            error = "not a number : " + tok;
+            return nullptr;
+        }
+    }
+
+    if (option == "--gain" && v.size() == 1) {
+        // Q12 would clamp it silently
+        if (v[0] > AudioGain::MAX_GAIN_DB) {
+            ostringstream oss;
+            oss << "at most +" << AudioGain::MAX_GAIN_DB << " dB, repeat --gain for more";
+            error = oss.str();
+            return nullptr;
+        }
+        return unique_ptr<AudioStage>(new AudioGain(v[0]));
+    }
+    if (option == "--eq" && v.size() == 3 && v[0] > 0 && v[1] > 0)
+        return unique_ptr<AudioStage>(new AudioBiquad(v[0], v[1], v[2]));
+    if (option == "--limit" && v.size() == 1)
+        return unique_ptr<AudioStage>(new AudioLimiter(v[0]));
+    if (option == "--remap" && !v.empty()) {
+        // The number of channels stays the same, so each index is one of the map size
+        vector<int> map;
+        for (double c : v) {
+            if (c != floor(c) || c < 0 || c >= v.size()) {
+                error = "channel indices must be 0 ... " + to_string(v.size() - 1);
+                return nullptr;
+            }
+            map.push_back(int(c));
+        }
+        return unique_ptr<AudioStage>(new AudioRemap(map));
+    }
+    error = "bad value";
+    return nullptr;
+}
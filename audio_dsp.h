@@ -0,0 +1,140 @@
+//
+// Created by IT-JIM
+// AUDIO_DSP: In-place DSP stages for S16LE interleaved audio (gain, biquad EQ, limiter, channel remap)
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <string>
+
+//======================================================================================================================
+/// One in-place DSP stage for S16LE interleaved audio
+class AudioStage {
+public:
+    virtual ~AudioStage() = default;
+
+    /// Set up for the given format, called before the first buffer and whenever the format changes, resets the state
+    virtual void configure(int, int) {}
+
+    /// Process numFrames frames (numFrames * channels samples) in-place
+    virtual void process(int16_t *samples, size_t numFrames) = 0;
+
+    virtual std::string name() const = 0;
+};
+
+//======================================================================================================================
+/// Gain in dB, fixed point with saturation, SIMD
+class AudioGain : public AudioStage {
+public:
+    /// The highest gain Q12 can hold (just below 8x)
+    static constexpr double MAX_GAIN_DB = 18;
+
+    explicit AudioGain(double gainDb);
+
+    void configure(int channels, int rate) override;
+    void process(int16_t *samples, size_t numFrames) override;
+    std::string name() const override;
+
+private:
+    double gainDb;
+    /// Gain in Q12 fixed point, i.e. up to 8x (+18 dB)
+    int16_t gainQ12 = 4096;
+    int channels = 0;
+};
+
+//======================================================================================================================
+/// Peaking EQ biquad (RBJ cookbook), one filter state per channel
+/// The filter is recursive in time, so the SIMD lanes are the channels: 4 (SSE2) or 8 (AVX2) at once
+class AudioBiquad : public AudioStage {
+public:
+    AudioBiquad(double freq, double q, double gainDb);
+
+    void configure(int channels, int rate) override;
+    void process(int16_t *samples, size_t numFrames) override;
+    std::string name() const override;
+
+private:
+    double freq, q, gainDb;
+    int channels = 0;
+    /// Normalized coefficients
+    float b0 = 1, b1 = 0, b2 = 0, a1 = 0, a2 = 0;
+    /// Transposed direct form II state, per channel
+    std::vector<float> z1, z2;
+    /// The frequency is at or above Nyquist for the stream rate, the stage does nothing
+    bool bypass = false;
+};
+
+//======================================================================================================================
+/// Peak limiter: instant attack, exponential release, then a hard SIMD clip at the ceiling
+/// The gain is common for all channels of a frame, to keep the stereo image
+/// A SIMD peak scan skips the per-frame envelope for the buffers which need no limiting, the usual case
+class AudioLimiter : public AudioStage {
+public:
+    AudioLimiter(double ceilingDb, double releaseMs = 50);
+
+    void configure(int channels, int rate) override;
+    void process(int16_t *samples, size_t numFrames) override;
+    std::string name() const override;
+
+private:
+    double ceilingDb, releaseMs;
+    int channels = 0;
+    int16_t ceiling = 32767;
+    /// Per-frame release coefficient and the current gain
+    float release = 0, gain = 1;
+};
+
+//======================================================================================================================
+/// Channel remap: output channel i = input channel map[i], the number of channels stays the same
+/// The map is checked by parseAudioStage(); if the stream has another number of channels, the stage is passthrough
+class AudioRemap : public AudioStage {
+public:
+    explicit AudioRemap(const std::vector<int> &map);
+
+    void configure(int channels, int rate) override;
+    void process(int16_t *samples, size_t numFrames) override;
+    std::string name() const override;
+
+private:
+    std::vector<int> map;
+    std::vector<int16_t> frame;
+    /// The number of channels of the stream, the stage is active only if it matches the map
+    int channels = 0;
+};
+
+//======================================================================================================================
+/// A chain of stages, applied in order, with per-buffer timing
+class AudioChain {
+public:
+    void add(std::unique_ptr<AudioStage> stage);
+
+    bool empty() const { return stages.empty(); }
+
+    /// Reconfigure all stages if the format changed
+    void configure(int channels, int rate);
+
+    /// Process one buffer of S16LE interleaved audio in-place, return the processing time in nanoseconds
+    int64_t process(int16_t *samples, size_t numSamples);
+
+    /// Chain description, e.g. "gain(6 dB) -> limiter(-1 dB)"
+    std::string describe() const;
+
+    int channels = 0;
+    int rate = 0;
+
+    // Per-buffer timing statistics
+    int64_t countBuffers = 0;
+    int64_t sumNs = 0;
+    int64_t maxNs = 0;
+
+private:
+    std::vector<std::unique_ptr<AudioStage>> stages;
+};
+
+//======================================================================================================================
+/// Parse a stage from a command line option, return nullptr on a bad value, with the reason in error
+/// --gain <dB>, --eq <freq>:<q>:<dB>, --limit <dB>, --remap <c0>,<c1>,...
+std::unique_ptr<AudioStage> parseAudioStage(const std::string &option, const std::string &value, std::string &error);
@@ -0,0 +1,328 @@
+//
+// Created by IT-JIM
+// BENCH_BRIDGE: Headless throughput/latency benchmark of the goblin -> processing -> elf bridge
+// The same BridgeEngine and topology as video3, audio1 and av1, but with test sources and fakesinks, not synced to the clock
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <ctime>
+
+#include <gst/gst.h>
+
+#include "kernels.h"
+#include "gstbridge.h"
+
+//======================================================================================================================
+/// CPU time of the whole process (all threads) in nanoseconds
+inline int64_t cpuNs() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+//======================================================================================================================
+/// What the bridge does with the buffers, like the options of video3, audio1 and av1
+enum class BridgeMode {
+    /// Copy into a new buffer (and process the copy for video)
+    COPY,
+    /// Process video in the goblin buffer, push the same buffer
+    INPLACE,
+    /// Forward the goblin buffer by reference
+    PASSTHROUGH,
+};
+
+const char *bridgeModeName(BridgeMode mode) {
+    switch (mode) {
+        case BridgeMode::INPLACE:
+            return "inplace";
+        case BridgeMode::PASSTHROUGH:
+            return "passthrough";
+        default:
+            return "copy";
+    }
+}
+
+//======================================================================================================================
+/// One benchmark case: a topology with one or two streams
+struct BenchCase {
+    /// Which example this mimics: video3, audio1 or av1
+    std::string topology;
+    BridgeMode modeV = BridgeMode::COPY;
+    BridgeMode modeA = BridgeMode::PASSTHROUGH;
+    int imW = 0, imH = 0;
+    int channels = 2;
+    /// Video processing format: BGR (converted from the source format and back) or the source format itself
+    std::string format = "BGR";
+};
+
+/// The results of one case
+struct BenchResult {
+    BenchCase bc;
+    double wallMs = 0;
+    double cpuUsPerBuffer = 0;
+    /// Colorspace conversions per video frame, goblin + elf
+    int conversions = 0;
+
+    struct Stream {
+        std::string name;
+        const char *mode;
+        int64_t buffers;
+        double fps, mbps, p50Us, p99Us, maxUs;
+    };
+    std::vector<Stream> streams;
+};
+
+//======================================================================================================================
+/// Run one case: build both pipelines, push numBuffers buffers per stream through the bridge engine, measure
+/// The video source gives srcFormat, like a decoder; processing in another format costs a videoconvert on each side
+/// opts are the bridge options from the command line, as in the examples; interleaveMs is for av1 only
+BenchResult runCase(const BenchCase &bc, int numBuffers, const std::string &pattern, const std::string &srcFormat,
+                    const BridgeOptions &opts, int interleaveMs) {
+    using namespace std;
+    bool hasV = bc.topology != "audio1";
+    bool hasA = bc.topology != "video3";
+
+    ostringstream capsSrc, capsV, capsA;
+    capsSrc << "video/x-raw,format=" << srcFormat << ",width=" << bc.imW << ",height=" << bc.imH << ",framerate=30/1";
+    capsV << "video/x-raw,format=" << bc.format << ",width=" << bc.imW << ",height=" << bc.imH << ",framerate=30/1";
+    capsA << "audio/x-raw,format=S16LE,layout=interleaved,rate=48000,channels=" << bc.channels;
+
+    // Goblin: test sources -> appsinks, as fast as possible
+    // enable-last-sample=false : appsink must not keep an extra reference to the buffer we process in-place
+    ostringstream goblinStr, elfStr;
+    if (hasV)
+        goblinStr << "videotestsrc num-buffers=" << numBuffers << " pattern=" << pattern << " ! " << capsSrc.str() <<
+                  " ! videoconvert ! " << capsV.str() << " ! appsink name=goblin_sink_v sync=false max-buffers=2 enable-last-sample=false ";
+    if (hasA)
+        goblinStr << "audiotestsrc num-buffers=" << numBuffers << " samplesperbuffer=1024 ! " << capsA.str() <<
+                  " ! appsink name=goblin_sink_a sync=false max-buffers=2 enable-last-sample=false ";
+    // Elf: appsrcs -> fakesinks, the engine sets the appsrc caps from the first samples
+    // The video fakesink takes the source format only, like a real sink or encoder would
+    if (hasV)
+        elfStr << "appsrc name=elf_src_v format=time ! videoconvert ! " << capsSrc.str() <<
+               " ! fakesink name=elf_sink_v sync=false ";
+    if (hasA)
+        elfStr << "appsrc name=elf_src_a format=time ! fakesink name=elf_sink_a sync=false ";
+
+    BridgeEngine engine(goblinStr.str(), elfStr.str());
+    if (bc.topology == "av1")
+        engine.interleaveSkewNs = int64_t(interleaveMs) * GST_MSECOND;
+    // The latency is the engine trace, from the appsink pull to the elf sink
+    BridgeOptions optsCase = opts;
+    optsCase.trace = true;
+    vector<BridgeStream *> streams;
+    if (hasV) {
+        BridgeOptions optsV = optsCase;
+        // Let elf queue a few frames only, like a real sink would
+        if (optsV.maxBytes == 0) {
+            GstVideoInfo info;
+            GstCaps *caps = gst_caps_from_string(capsV.str().c_str());
+            MY_ASSERT(gst_video_info_from_caps(&info, caps));
+            gst_caps_unref(caps);
+            optsV.maxBytes = guint64(4) * GST_VIDEO_INFO_SIZE(&info);
+        }
+        BridgeStream &streamV = engine.addStream(optsV, "goblin_sink_v", "elf_src_v", "elf_sink_v", "V : ");
+        bool inPlace = bc.modeV == BridgeMode::INPLACE;
+        streamV.passthrough = bc.modeV == BridgeMode::PASSTHROUGH;
+        streamV.process = [inPlace](BridgeStream &stream, GstSample *sample) {
+            return processBufferInvertRoi(stream, sample, inPlace);
+        };
+        streams.push_back(&streamV);
+    }
+    if (hasA) {
+        // Audio is never processed, only forwarded or copied, like in audio1 and av1 without DSP stages
+        BridgeOptions optsA = optsCase;
+        optsA.numWorkers = 0;
+        optsA.batchSize = 0;
+        BridgeStream &streamA = engine.addStream(optsA, "goblin_sink_a", "elf_src_a", "elf_sink_a", "A : ");
+        streamA.poolMargin = 2;
+        if (bc.modeA == BridgeMode::COPY)
+            streamA.process = copyBuffer;
+        streams.push_back(&streamA);
+    }
+
+    // Go !
+    int64_t wall0 = nowNs(), cpu0 = cpuNs();
+    engine.run();
+    int64_t wall1 = nowNs(), cpu1 = cpuNs();
+
+    // Results
+    BenchResult res;
+    res.bc = bc;
+    res.conversions = engine.conversionsGoblin + engine.conversionsElf;
+    res.wallMs = (wall1 - wall0) * 1e-6;
+    int64_t totalBuffers = 0;
+    for (BridgeStream *stream : streams) {
+        BridgeStream &s = *stream;
+        bool isV = hasV && &s == streams.front();
+        double sec = max<int64_t>(s.tEndNs - s.tStartNs, 1) * 1e-9;
+        int64_t buffers = s.countPushed;
+        LatencyHistogram latency = s.trace.total();
+        res.streams.push_back({isV ? "V" : "A", bridgeModeName(isV ? bc.modeV : bc.modeA), buffers, buffers / sec,
+                               s.bytesPushed / sec * 1e-6, latency.percentileUs(0.5), latency.percentileUs(0.99),
+                               latency.maxUs()});
+        totalBuffers += buffers;
+    }
+    res.cpuUsPerBuffer = totalBuffers ? (cpu1 - cpu0) * 1e-3 / totalBuffers : 0;
+    return res;
+}
+
+//======================================================================================================================
+/// Write all results as JSON
+void writeJson(const std::string &fileName, const std::vector<BenchResult> &results, int numBuffers) {
+    using namespace std;
+    ofstream out(fileName);
+    MY_ASSERT(out.good());
+    out << "{\n  \"num_buffers\": " << numBuffers << ",\n  \"simd\": \"" << simdLevelName(simdLevel()) <<
+        "\",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult &r = results[i];
+        out << "    {\"topology\": \"" << r.bc.topology << "\", \"width\": " << r.bc.imW << ", \"height\": " <<
+            r.bc.imH << ", \"format\": \"" << r.bc.format << "\", \"conversions_per_frame\": " << r.conversions <<
+            ", \"channels\": " << r.bc.channels << ", \"wall_ms\": " << r.wallMs <<
+            ", \"cpu_us_per_buffer\": " << r.cpuUsPerBuffer << ", \"streams\": [";
+        for (size_t j = 0; j < r.streams.size(); ++j) {
+            const BenchResult::Stream &s = r.streams[j];
+            out << (j ? ", " : "") << "{\"stream\": \"" << s.name << "\", \"mode\": \"" << s.mode <<
+                "\", \"buffers\": " << s.buffers << ", \"buffers_per_s\": " << s.fps << ", \"mb_per_s\": " <<
+                s.mbps << ", \"latency_p50_us\": " << s.p50Us << ", \"latency_p99_us\": " << s.p99Us <<
+                ", \"latency_max_us\": " << s.maxUs << "}";
+        }
+        out << "]}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+//======================================================================================================================
+int main(int argc, char **argv) {
+    using namespace std;
+    cout << "BENCH_BRIDGE: Headless throughput/latency benchmark of the goblin -> processing -> elf bridge" << endl;
+
+    // Init gstreamer
+    gst_init(&argc, &argv);
+
+    // The engine logs every stream start and EOS, the benchmark prints its own results
+    logSetLevel(LogLevel::WARN);
+
+    BridgeOptions opts;
+    int interleaveMs = 0;
+    int numBuffers = 300;
+    string jsonName = "bench_bridge.json";
+    string only;
+    string pattern = "smpte";
+    string srcFormat = "I420", onlyFormat;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "--buffers" && i + 1 < argc) {
+            if (!parseIntArg(argv[++i], numBuffers, 1))
+                cout << "Bad value for " << arg << " : " << argv[i] << endl;
+        } else if (arg == "--json" && i + 1 < argc)
+            jsonName = argv[++i];
+        else if (arg == "--only" && i + 1 < argc)
+            only = argv[++i];
+        else if (arg == "--pattern" && i + 1 < argc)
+            pattern = argv[++i];
+        else if (arg == "--src-format" && i + 1 < argc)
+            srcFormat = argv[++i];
+        else if (arg == "--format" && i + 1 < argc)
+            onlyFormat = argv[++i];
+        else if (arg == "--interleave" && i + 1 < argc) {
+            if (!parseIntArg(argv[++i], interleaveMs))
+                cout << "Bad value for " << arg << " : " << argv[i] << endl;
+        } else if (!parseBridgeOption(opts, i, argc, argv)) {
+            cout << "Usage:\nbench_bridge [--buffers <n>] [--json <file>] [--only video3|audio1|av1] [--pattern <p>]\n" <<
+                    "             [--src-format <f>] [--format <f>] [--interleave <ms>] [bridge options]" << endl;
+            cout << "  --buffers <n> : buffers per stream and case, default 300" << endl;
+            cout << "  --json <file> : where to write the results, default bench_bridge.json" << endl;
+            cout << "  --only <topology> : run only the cases of one example" << endl;
+            cout << "  --pattern <p> : videotestsrc pattern, default smpte, e.g. black makes the source cheaper" << endl;
+            cout << "  --src-format <f> : video source (decoder) format, I420 or NV12, default I420" << endl;
+            cout << "  --format <f> : run only the video cases processed in this format: BGR, I420 or NV12" << endl;
+            cout << "  --interleave <ms> : A/V interleaving skew of the av1 cases, default 0 = off" << endl;
+            cout << "  The bridge options (workers, batches, pools, queues...) apply to every case, like in the examples" << endl;
+            printBridgeUsage();
+            return 0;
+        }
+    }
+
+    // The case matrix: every video mode at every resolution, then audio, then audio + video
+    struct Res {
+        int w, h;
+    };
+    const Res resolutions[] = {{640, 480}, {1280, 720}, {1920, 1080}, {3840, 2160}};
+    // Video is processed in BGR (the old way, converted from the source format and back) or in the source format
+    vector<string> formats = {"BGR", srcFormat};
+    vector<BenchCase> cases;
+    for (const Res &res : resolutions)
+        for (BridgeMode mode : {BridgeMode::COPY, BridgeMode::INPLACE, BridgeMode::PASSTHROUGH})
+            for (const string &format : formats) {
+                BenchCase bc;
+                bc.topology = "video3";
+                bc.modeV = mode;
+                bc.imW = res.w;
+                bc.imH = res.h;
+                bc.format = format;
+                cases.push_back(bc);
+            }
+    for (int channels : {2, 32})
+        for (BridgeMode mode : {BridgeMode::COPY, BridgeMode::PASSTHROUGH}) {
+            BenchCase bc;
+            bc.topology = "audio1";
+            bc.modeA = mode;
+            bc.channels = channels;
+            cases.push_back(bc);
+        }
+    for (const Res &res : resolutions)
+        for (BridgeMode mode : {BridgeMode::COPY, BridgeMode::INPLACE})
+            for (const string &format : formats) {
+                BenchCase bc;
+                bc.topology = "av1";
+                bc.modeV = mode;
+                bc.imW = res.w;
+                bc.imH = res.h;
+                bc.format = format;
+                cases.push_back(bc);
+            }
+
+    vector<BenchResult> results;
+    for (const BenchCase &bc : cases) {
+        if (!only.empty() && bc.topology != only)
+            continue;
+        if (!onlyFormat.empty() && bc.imW > 0 && bc.format != onlyFormat)
+            continue;
+        BenchResult r = runCase(bc, numBuffers, pattern, srcFormat, opts, interleaveMs);
+        cout << "\n" << bc.topology;
+        if (bc.imW > 0)
+            cout << " " << bc.imW << "x" << bc.imH << " " << bc.format;
+        if (bc.topology != "video3")
+            cout << " " << bc.channels << " ch";
+        cout << " : wall = " << r.wallMs << " ms, cpu = " << r.cpuUsPerBuffer << " us/buffer";
+        if (bc.imW > 0)
+            cout << ", conversions = " << r.conversions << " per frame";
+        cout << endl;
+        for (const BenchResult::Stream &s : r.streams)
+            cout << "  " << s.name << " " << s.mode << " : " << s.fps << " buffers/s, " << s.mbps <<
+                 " MB/s, latency p50 = " << s.p50Us << " us, p99 = " << s.p99Us << " us, max = " << s.maxUs << " us" << endl;
+        results.push_back(r);
+    }
+
+    // Native format vs BGR: the same case run both ways, right one after the other
+    cout << "\nProcessing in " << srcFormat << " instead of BGR :" << endl;
+    for (size_t i = 1; i < results.size(); ++i) {
+        const BenchResult &b = results[i - 1], &n = results[i];
+        if (b.bc.format != "BGR" || n.bc.format != srcFormat || b.bc.imW == 0 || b.bc.topology != n.bc.topology ||
+            b.bc.imW != n.bc.imW || b.bc.modeV != n.bc.modeV)
+            continue;
+        cout << "  " << n.bc.topology << " " << n.bc.imW << "x" << n.bc.imH << " " << bridgeModeName(n.bc.modeV) <<
+             " : conversions removed = " << b.conversions - n.conversions << " per frame, cpu = " <<
+             b.cpuUsPerBuffer << " -> " << n.cpuUsPerBuffer << " us/buffer" << endl;
+    }
+
+    writeJson(jsonName, results, numBuffers);
+    cout << "\nResults written to " << jsonName << endl;
+    return 0;
+}
+//======================================================================================================================
@@ -0,0 +1,89 @@
+//
+// Created by IT-JIM
+// BENCH_KERNELS: ROI photo negative, cv::bitwise_not() vs the SIMD kernels, at 720p, 1080p and 4K
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstring>
+
+#include <opencv2/opencv.hpp>
+
+#include "kernels.h"
+
+//======================================================================================================================
+/// A simple assertion function + macro
+inline void myAssert(bool b, const std::string &s = "MYASSERT ERROR !") {
+    if (!b)
+        throw std::runtime_error(s);
+}
+
+#define MY_ASSERT(x) myAssert(x, "MYASSERT ERROR :" #x)
+
+//======================================================================================================================
+/// Time one ROI negative method on a BGR frame, return milliseconds per frame
+template<typename F>
+double timeIt(F &&f, int numIter) {
+    using namespace std::chrono;
+    f(); // Warm-up
+    auto t0 = steady_clock::now();
+    for (int i = 0; i < numIter; ++i)
+        f();
+    auto t1 = steady_clock::now();
+    return duration<double, std::milli>(t1 - t0).count() / numIter;
+}
+
+//======================================================================================================================
+int main(int argc, char **argv) {
+    using namespace std;
+    using namespace cv;
+    cout << "BENCH_KERNELS: ROI photo negative, cv::bitwise_not() vs the SIMD kernels" << endl;
+    cout << "Detected SIMD level : " << simdLevelName(simdDetectLevel()) << endl;
+
+    int numIter = argc > 1 ? stoi(argv[1]) : 200;
+
+    struct Res {
+        const char *name;
+        int w, h;
+    };
+    for (const Res &res : {Res{"720p", 1280, 720}, Res{"1080p", 1920, 1080}, Res{"4K", 3840, 2160}}) {
+        int imW = res.w, imH = res.h;
+        Mat frame(imH, imW, CV_8UC3);
+        randu(frame, Scalar(0, 0, 0), Scalar(256, 256, 256));
+        // The ROI is the middle 1/9 of the image, like in video3 and av1
+        Rect2i roi(imW / 3, imH / 3, imW / 3, imH / 3);
+        size_t roiBytes = size_t(roi.width) * 3 * roi.height;
+
+        // Reference result
+        Mat ref = frame.clone();
+        Mat refMid(ref, roi);
+        bitwise_not(refMid, refMid);
+
+        cout << "\n" << res.name << " (" << imW << "x" << imH << "), ROI " << roi.width << "x" << roi.height << endl;
+
+        Mat work = frame.clone();
+        Mat workMid(work, roi);
+        double msCv = timeIt([&workMid] {
+            bitwise_not(workMid, workMid);
+        }, numIter);
+        cout << "  cv::bitwise_not : " << msCv << " ms/frame, " << roiBytes / msCv * 1e-6 << " GB/s" << endl;
+
+        for (int l = 0; l <= (int) simdDetectLevel(); ++l) {
+            SimdLevel level = SimdLevel(l);
+            uint8_t *roiData = work.data + roi.y * work.step + roi.x * 3;
+
+            // Check the result first, then time it
+            frame.copyTo(work);
+            kernelInvert(level, roiData, roi.width * 3, roi.height, work.step);
+            MY_ASSERT(memcmp(work.data, ref.data, work.step * work.rows) == 0);
+
+            double ms = timeIt([&] {
+                kernelInvert(level, roiData, roi.width * 3, roi.height, work.step);
+            }, numIter);
+            cout << "  " << simdLevelName(level) << " : " << ms << " ms/frame, " << roiBytes / ms * 1e-6 <<
+                 " GB/s, x" << msCv / ms << " vs OpenCV" << endl;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,15 @@
+//
+// Created by IT-JIM
+// CLOCK_NS: The steady clock of all modules, in nanoseconds, so that their timestamps compare
+
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+
+//======================================================================================================================
+/// Steady clock time in nanoseconds
+inline int64_t nowNs() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,206 @@
+//
+// Created by IT-JIM
+// FRAME_RECORD: Raw frame record/replay, for repeatable decode-free benchmarks of the processing stage
+// The recorder dumps the goblin samples into one indexed file, the replay mmaps it and pushes the frames without copies
+
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gstbridge.h"
+#include "frame_record.h"
+
+static const char RECORD_MAGIC[8] = {'G', 'B', 'R', 'E', 'C', 'O', 'R', 'D'};
+static constexpr uint32_t RECORD_VERSION = 1;
+/// Payload alignment: a page on x86 and most ARM, so that the payloads can be wrapped right in the mapping
+static constexpr uint32_t RECORD_PAGE = 4096;
+/// The buffer flags which describe the media, the others are of no use in another process
+static constexpr guint RECORD_FLAGS = GST_BUFFER_FLAG_DISCONT | GST_BUFFER_FLAG_GAP | GST_BUFFER_FLAG_DELTA_UNIT |
+                                      GST_BUFFER_FLAG_HEADER | GST_BUFFER_FLAG_DROPPABLE | GST_BUFFER_FLAG_MARKER;
+
+//======================================================================================================================
+FrameRecorder::FrameRecorder(const std::string &fileName) : fileName(fileName) {
+    file = fopen(fileName.c_str(), "wb");
+    myAssert(file != nullptr, "Cannot create the record file " + fileName);
+    // A placeholder header, the real one is written by close()
+    padToPage();
+}
+
+//======================================================================================================================
+FrameRecorder::~FrameRecorder() {
+    close();
+}
+
+//======================================================================================================================
+void FrameRecorder::write(GstSample *sample) {
+    MY_ASSERT(file != nullptr);
+    GstCaps *caps = gst_sample_get_caps(sample);
+    MY_ASSERT(caps != nullptr);
+    if (caps != capsLast && (capsLast == nullptr || !gst_caps_is_equal(caps, capsLast))) {
+        gchar *str = gst_caps_to_string(caps);
+        capsStrings.emplace_back(str);
+        g_free(str);
+    }
+    gst_caps_replace(&capsLast, caps);
+
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstMapInfo map;
+    MY_ASSERT(gst_buffer_map(buffer, &map, GST_MAP_READ));
+    FrameRecordEntry e;
+    e.offset = pos;
+    e.size = map.size;
+    e.pts = GST_BUFFER_PTS(buffer);
+    e.duration = GST_BUFFER_DURATION(buffer);
+    e.flags = GST_BUFFER_FLAGS(buffer) & RECORD_FLAGS;
+    e.capsIndex = uint32_t(capsStrings.size() - 1);
+    writeBytes(map.data, map.size);
+    gst_buffer_unmap(buffer, &map);
+    padToPage();
+    index.push_back(e);
+}
+
+//======================================================================================================================
+void FrameRecorder::close() {
+    if (file == nullptr)
+        return;
+    FrameRecordHeader h{};
+    memcpy(h.magic, RECORD_MAGIC, sizeof(h.magic));
+    h.version = RECORD_VERSION;
+    h.pageSize = RECORD_PAGE;
+    h.countFrames = index.size();
+    h.countCaps = capsStrings.size();
+    h.capsOffset = pos;
+    for (const std::string &s : capsStrings)
+        writeBytes(s.c_str(), s.size() + 1);
+    h.capsSize = pos - h.capsOffset;
+    // The index entries are 8-byte aligned in the mapping
+    static const char zeros[8] = {};
+    writeBytes(zeros, (8 - pos % 8) % 8);
+    h.indexOffset = pos;
+    if (!index.empty())
+        writeBytes(index.data(), index.size() * sizeof(FrameRecordEntry));
+    MY_ASSERT(fseek(file, 0, SEEK_SET) == 0);
+    MY_ASSERT(fwrite(&h, sizeof(h), 1, file) == 1);
+    MY_ASSERT(fclose(file) == 0);
+    file = nullptr;
+    gst_caps_replace(&capsLast, nullptr);
+    LOG_INFO << "Recorded " << index.size() << " frames to " << fileName;
+}
+
+//======================================================================================================================
+void FrameRecorder::writeBytes(const void *data, size_t size) {
+    if (size == 0)
+        return;
+    myAssert(fwrite(data, 1, size, file) == size, "Cannot write the record file " + fileName);
+    pos += size;
+}
+
+//======================================================================================================================
+void FrameRecorder::padToPage() {
+    static const char zeros[RECORD_PAGE] = {};
+    writeBytes(zeros, (RECORD_PAGE - pos % RECORD_PAGE) % RECORD_PAGE);
+}
+
+//======================================================================================================================
+struct FrameReplay::Mapping {
+    void *data = MAP_FAILED;
+    size_t size = 0;
+
+    ~Mapping() {
+        if (data != MAP_FAILED)
+            munmap(data, size);
+    }
+};
+
+//======================================================================================================================
+FrameReplay::FrameReplay(const std::string &fileName) : mapping(std::make_shared<Mapping>()) {
+    int fd = open(fileName.c_str(), O_RDONLY);
+    myAssert(fd >= 0, "Cannot open the record file " + fileName);
+    struct stat st;
+    MY_ASSERT(fstat(fd, &st) == 0);
+    mapping->size = st.st_size;
+    myAssert(mapping->size >= sizeof(FrameRecordHeader), "Not a record file : " + fileName);
+    mapping->data = mmap(nullptr, mapping->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after close()
+    ::close(fd);
+    MY_ASSERT(mapping->data != MAP_FAILED);
+    // The frames are read once, front to back (or loop)
+    madvise(mapping->data, mapping->size, MADV_SEQUENTIAL);
+
+    const uint8_t *base = (const uint8_t *) mapping->data;
+    header = (const FrameRecordHeader *) base;
+    myAssert(memcmp(header->magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) == 0 && header->version == RECORD_VERSION,
+             "Not a record file, or a different version : " + fileName);
+    MY_ASSERT(header->indexOffset + header->countFrames * sizeof(FrameRecordEntry) <= mapping->size);
+    MY_ASSERT(header->capsOffset + header->capsSize <= mapping->size);
+    index = (const FrameRecordEntry *) (base + header->indexOffset);
+
+    // Parse the caps strings once
+    const char *s = (const char *) (base + header->capsOffset);
+    const char *end = s + header->capsSize;
+    for (uint64_t i = 0; i < header->countCaps; ++i) {
+        size_t len = strnlen(s, end - s);
+        MY_ASSERT(s + len < end);
+        GstCaps *c = gst_caps_from_string(s);
+        myAssert(c != nullptr, std::string("Bad caps in the record file : ") + s);
+        caps.push_back(c);
+        s += len + 1;
+    }
+    for (uint64_t i = 0; i < header->countFrames; ++i)
+        MY_ASSERT(index[i].offset + index[i].size <= mapping->size && index[i].capsIndex < caps.size());
+    LOG_INFO << "Replay " << fileName << " : " << header->countFrames << " frames, " <<
+             (unsigned long long) mapping->size << " bytes mapped";
+}
+
+//======================================================================================================================
+FrameReplay::~FrameReplay() {
+    for (GstCaps *c : caps)
+        gst_caps_unref(c);
+}
+
+//======================================================================================================================
+GstSample *FrameReplay::sample(size_t i, GstClockTime ptsOffset) const {
+    const FrameRecordEntry &e = index[i];
+    // Each memory keeps the mapping alive
+    auto *ref = new std::shared_ptr<Mapping>(mapping);
+    GstMemory *mem = gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY, (uint8_t *) mapping->data + e.offset, e.size, 0,
+                                            e.size, ref, [](gpointer p) {
+                delete (std::shared_ptr<Mapping> *) p;
+            });
+    GstBuffer *buffer = gst_buffer_new();
+    gst_buffer_append_memory(buffer, mem);
+    GST_BUFFER_PTS(buffer) = GST_CLOCK_TIME_IS_VALID(e.pts) ? e.pts + ptsOffset : e.pts;
+    GST_BUFFER_DURATION(buffer) = e.duration;
+    GST_BUFFER_FLAG_SET(buffer, e.flags & RECORD_FLAGS);
+    GstSample *s = gst_sample_new(buffer, caps[e.capsIndex], nullptr, nullptr);
+    // The sample has its own reference
+    gst_buffer_unref(buffer);
+    return s;
+}
+
+//======================================================================================================================
+GstClockTime FrameReplay::endTime() const {
+    GstClockTime t = 0;
+    for (uint64_t i = 0; i < header->countFrames; ++i)
+        if (GST_CLOCK_TIME_IS_VALID(index[i].pts)) {
+            GstClockTime end = index[i].pts + (GST_CLOCK_TIME_IS_VALID(index[i].duration) ? index[i].duration : 0);
+            if (end > t)
+                t = end;
+        }
+    return t;
+}
+
+//======================================================================================================================
+void replayFrames(BridgeStream &stream, const FrameReplay &replay, int loops) {
+    GstClockTime loopTime = replay.endTime();
+    for (int loop = 0; loop < loops; ++loop)
+        for (size_t i = 0; i < replay.size(); ++i) {
+            // Nothing is fed before the caps are set, the first frame sets them
+            stream.engine->waitFeed(stream);
+            stream.engine->feed(stream, replay.sample(i, loop * loopTime));
+        }
+    // The engine signals EOS to the pipeline when we return
+}
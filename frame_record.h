@@ -0,0 +1,117 @@
+//
+// Created by IT-JIM
+// FRAME_RECORD: Raw frame record/replay, for repeatable decode-free benchmarks of the processing stage
+// The recorder dumps the goblin samples into one indexed file, the replay mmaps it and pushes the frames without copies
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <gst/gst.h>
+
+struct BridgeStream;
+
+//======================================================================================================================
+/// File layout: header | payloads, each one starts on a page boundary | caps strings | index
+/// Page-aligned payloads can be wrapped in GstMemory right from the mapping, and are aligned for SIMD too
+/// Native byte order, the file is for the machine that recorded it
+struct FrameRecordHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t pageSize;
+    uint64_t countFrames;
+    uint64_t indexOffset;
+    /// Caps strings, 0-terminated, one after another
+    uint64_t countCaps;
+    uint64_t capsOffset;
+    uint64_t capsSize;
+};
+
+/// One frame in the index
+struct FrameRecordEntry {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t pts;
+    uint64_t duration;
+    uint32_t flags;
+    /// Caps of this frame, index in the caps strings; a new one is added on every caps change
+    uint32_t capsIndex;
+};
+
+//======================================================================================================================
+/// Write the samples of one stream into a record file
+/// Not thread-safe: the engine calls write() from the thread which pulls the samples, in the stream order
+class FrameRecorder {
+public:
+    explicit FrameRecorder(const std::string &fileName);
+
+    /// Closes the file, if not closed yet
+    ~FrameRecorder();
+
+    FrameRecorder(const FrameRecorder &) = delete;
+
+    FrameRecorder &operator=(const FrameRecorder &) = delete;
+
+    /// Append one sample: its caps (if changed), PTS, duration, flags and payload; does not take ownership
+    void write(GstSample *sample);
+
+    /// Write the caps strings and the index, then the final header
+    void close();
+
+    uint64_t countFrames() const { return index.size(); }
+
+private:
+    void writeBytes(const void *data, size_t size);
+
+    /// Pad the file with zeros up to the next page boundary
+    void padToPage();
+
+    FILE *file = nullptr;
+    std::string fileName;
+    uint64_t pos = 0;
+    std::vector<FrameRecordEntry> index;
+    std::vector<std::string> capsStrings;
+    /// The caps of the last sample (our own reference), compared by pointer first
+    GstCaps *capsLast = nullptr;
+};
+
+//======================================================================================================================
+/// A record file mapped in memory
+/// sample() wraps the mapped payload in a read-only GstMemory: no read(), no copy, no decoding
+/// The mapping lives until the last such buffer is freed, even after the replay object itself
+class FrameReplay {
+public:
+    explicit FrameReplay(const std::string &fileName);
+
+    ~FrameReplay();
+
+    FrameReplay(const FrameReplay &) = delete;
+
+    FrameReplay &operator=(const FrameReplay &) = delete;
+
+    size_t size() const { return header->countFrames; }
+
+    /// Frame i as a new sample with its caps, PTS + ptsOffset, duration and flags
+    /// The memory is read-only: in-place processing gets a copy in gst_buffer_map(), a copy or passthrough do not
+    GstSample *sample(size_t i, GstClockTime ptsOffset = 0) const;
+
+    /// The end (PTS + duration) of the last frame, the PTS offset of the next loop
+    GstClockTime endTime() const;
+
+private:
+    /// The mmap() of the whole file, shared with all the GstMemory objects
+    struct Mapping;
+    std::shared_ptr<Mapping> mapping;
+    const FrameRecordHeader *header = nullptr;
+    const FrameRecordEntry *index = nullptr;
+    std::vector<GstCaps *> caps;
+};
+
+//======================================================================================================================
+/// Source callback body: push all frames of the replay through the stream processing to elf, loops times
+/// Frames go as fast as elf takes them (need-data), the PTS keeps growing from one loop to the next
+void replayFrames(BridgeStream &stream, const FrameReplay &replay, int loops = 1);
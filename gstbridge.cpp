@@ -0,0 +1,1669 @@
+//
+// Created by IT-JIM
+// GSTBRIDGE: The goblin (appsinks) -> processing -> elf (appsrcs) bridge engine, shared by the examples
+
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include <gst/base/gstbasetransform.h>
+
+#include "kernels.h"
+#include "gstbridge.h"
+
+//======================================================================================================================
+bool feedGateOpen(FeedGate &gate) {
+    if (gate.flagRun)
+        return false;
+    gate.openTimeNs = nowNs();
+    {
+        // Set the flag under the mutex, or the producer can miss the notification
+        std::lock_guard<std::mutex> lock(gate.mutex);
+        gate.flagRun = true;
+    }
+    gate.cond.notify_all();
+    return true;
+}
+
+//======================================================================================================================
+bool feedGateClose(FeedGate &gate) {
+    if (!gate.flagRun)
+        return false;
+    std::lock_guard<std::mutex> lock(gate.mutex);
+    gate.flagRun = false;
+    return true;
+}
+
+//======================================================================================================================
+void feedGateWait(FeedGate &gate, const std::string &prefix) {
+    using namespace std;
+    if (gate.flagRun)
+        return;
+    LOG_DEBUG << prefix << "(wait)";
+    int64_t t0 = nowNs();
+    if (gate.poll) {
+        while (!gate.flagRun)
+            this_thread::sleep_for(chrono::milliseconds(10));
+    } else {
+        unique_lock<mutex> lock(gate.mutex);
+        gate.cond.wait(lock, [&gate]{ return bool(gate.flagRun); });
+    }
+    int64_t t1 = nowNs();
+    ++gate.countStalls;
+    gate.stallNs += t1 - t0;
+    int64_t tOpen = gate.openTimeNs;
+    if (tOpen > t0)
+        gate.wakeNs += t1 - tOpen;
+}
+
+//======================================================================================================================
+void feedGatePrintStats(const FeedGate &gate, const std::string &prefix) {
+    using namespace std;
+    double stallMs = gate.stallNs * 1e-6;
+    double wakeUs = gate.countStalls ? gate.wakeNs * 1e-3 / gate.countStalls : 0;
+    cout << prefix << "Feed stalls (" << (gate.poll ? "poll" : "condvar") << ") : count = " << gate.countStalls <<
+         ", total = " << stallMs << " ms, average wake-up latency = " << wakeUs << " us" << endl;
+}
+
+//======================================================================================================================
+bool busProcessMsg(GstElement *pipeline, GstMessage *msg, const std::string &prefix) {
+    GstMessageType mType = GST_MESSAGE_TYPE(msg);
+    const char *what = "";
+    switch (mType) {
+        case (GST_MESSAGE_ERROR): {
+            // Parse error and exit program, hard exit
+            GError *err;
+            gchar *dbg;
+            gst_message_parse_error(msg, &err, &dbg);
+            LOG_ERROR << "[" << prefix << "] : mType = " << mType << " ERR = " << err->message << " FROM " <<
+                      GST_OBJECT_NAME(msg->src);
+            LOG_ERROR << "DBG = " << (dbg ? dbg : "");
+            g_clear_error(&err);
+            g_free(dbg);
+            // Print the log before we go
+            logFlush();
+            exit(1);
+        }
+        case (GST_MESSAGE_EOS) :
+            // Soft exit on EOS
+            LOG_INFO << "[" << prefix << "] : mType = " << mType << "  EOS !";
+            return false;
+        case (GST_MESSAGE_STATE_CHANGED):
+            // Parse state change, print extra info for pipeline only
+            LOG_INFO << "[" << prefix << "] : mType = " << mType << " State changed !";
+            if (GST_MESSAGE_SRC(msg) == GST_OBJECT(pipeline)) {
+                GstState sOld, sNew, sPenging;
+                gst_message_parse_state_changed(msg, &sOld, &sNew, &sPenging);
+                LOG_INFO << "Pipeline changed from " << gst_element_state_get_name(sOld) << " to " <<
+                         gst_element_state_get_name(sNew);
+            }
+            return true;
+        case (GST_MESSAGE_STEP_START):
+            what = "STEP START !";
+            break;
+        case (GST_MESSAGE_STREAM_STATUS):
+            what = "STREAM STATUS !";
+            break;
+        case (GST_MESSAGE_ELEMENT):
+            what = "MESSAGE ELEMENT !";
+            break;
+
+            // You can add more stuff here if you want
+
+        default:
+            break;
+    }
+    LOG_INFO << "[" << prefix << "] : mType = " << mType << " " << what;
+    return true;
+}
+
+//======================================================================================================================
+BusDispatcher::~BusDispatcher() {
+    stop();
+    for (auto &watch : watches) {
+        gst_bus_set_sync_handler(watch->bus, nullptr, nullptr, nullptr);
+        gst_object_unref(watch->bus);
+    }
+}
+
+//======================================================================================================================
+void BusDispatcher::add(GstElement *pipeline, const std::string &prefix, Handler handler) {
+    std::unique_ptr<Watch> watch(new Watch);
+    watch->dispatcher = this;
+    watch->pipeline = pipeline;
+    watch->bus = gst_element_get_bus(pipeline);
+    watch->prefix = prefix;
+    if (handler)
+        watch->handler = handler;
+    else
+        watch->handler = [prefix](GstElement *p, GstMessage *msg) {
+            return busProcessMsg(p, msg, prefix);
+        };
+    Watch *w = watch.get();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        watches.push_back(std::move(watch));
+    }
+    gst_bus_set_sync_handler(w->bus, onSyncMessage, w, nullptr);
+    // Messages posted before the sync handler was set are still in the bus queue
+    while (GstMessage *msg = gst_bus_pop(w->bus))
+        post(w, msg);
+}
+
+//======================================================================================================================
+void BusDispatcher::remove(GstElement *pipeline) {
+    std::unique_ptr<Watch> watch;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto it = std::find_if(watches.begin(), watches.end(),
+                               [pipeline](const std::unique_ptr<Watch> &w) { return w->pipeline == pipeline; });
+        if (it == watches.end())
+            return;
+        watch = std::move(*it);
+        watches.erase(it);
+        // Wait if its handler is running right now, then drop its messages still in the queue
+        Watch *w = watch.get();
+        condDone.wait(lock, [this, w]{ return busyWatch != w; });
+        for (auto q = queue.begin(); q != queue.end();) {
+            if (q->first == w) {
+                gst_message_unref(q->second);
+                q = queue.erase(q);
+            } else {
+                ++q;
+            }
+        }
+    }
+    gst_bus_set_sync_handler(watch->bus, nullptr, nullptr, nullptr);
+    gst_object_unref(watch->bus);
+}
+
+//======================================================================================================================
+void BusDispatcher::start() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (thread.joinable())
+        return;
+    flagStop = false;
+    thread = std::thread([this]{
+        codeThreadDispatch();
+    });
+}
+
+//======================================================================================================================
+void BusDispatcher::waitDone(GstElement *pipeline) {
+    std::unique_lock<std::mutex> lock(mutex);
+    condDone.wait(lock, [this, pipeline]{
+        for (auto &watch : watches)
+            if (watch->pipeline == pipeline)
+                return watch->flagDone;
+        // Not watched (any more)
+        return true;
+    });
+}
+
+//======================================================================================================================
+void BusDispatcher::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!thread.joinable())
+            return;
+        flagStop = true;
+    }
+    condMsg.notify_all();
+    thread.join();
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &item : queue)
+        gst_message_unref(item.second);
+    queue.clear();
+}
+
+//======================================================================================================================
+/// Bus sync handler: runs in whatever thread posts the message (usually a streaming thread), must be quick
+GstBusSyncReply BusDispatcher::onSyncMessage(GstBus *bus, GstMessage *msg, gpointer userData) {
+    Watch *watch = (Watch *) userData;
+    // DROP unrefs the message, so the queue takes a reference of its own
+    watch->dispatcher->post(watch, gst_message_ref(msg));
+    return GST_BUS_DROP;
+}
+
+//======================================================================================================================
+void BusDispatcher::post(Watch *watch, GstMessage *msg) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // A late message from a pipeline which is being removed
+        if (std::none_of(watches.begin(), watches.end(), [watch](const std::unique_ptr<Watch> &w) { return w.get() == watch; })) {
+            gst_message_unref(msg);
+            return;
+        }
+        queue.emplace_back(watch, msg);
+        maxQueueDepth = std::max(maxQueueDepth, queue.size());
+    }
+    condMsg.notify_one();
+}
+
+//======================================================================================================================
+/// The only bus thread: take the messages from the queue and give them to the handlers of their pipelines
+void BusDispatcher::codeThreadDispatch() {
+    using namespace std;
+    for (;;) {
+        pair<Watch *, GstMessage *> item;
+        {
+            unique_lock<std::mutex> lock(mutex);
+            condMsg.wait(lock, [this]{ return !queue.empty() || flagStop; });
+            if (flagStop)
+                break;
+            item = queue.front();
+            queue.pop_front();
+            ++countMessages;
+            // remove() waits while we are busy with this watch
+            busyWatch = item.first;
+        }
+
+        // The handler runs without the mutex, it can take a while (or call exit() on errors)
+        Watch *watch = item.first;
+        bool res = watch->flagDone || watch->handler(watch->pipeline, item.second);
+        gst_message_unref(item.second);
+        if (!res)
+            LOG_INFO << "BUS FINISHED : " << watch->prefix;
+        {
+            lock_guard<std::mutex> lock(mutex);
+            if (!res)
+                watch->flagDone = true;
+            busyWatch = nullptr;
+        }
+        condDone.notify_all();
+    }
+}
+
+//======================================================================================================================
+GstBufferPool *createElfPool(GstCaps *caps, guint bufferSize, guint maxBuffers) {
+    GstBufferPool *pool = gst_buffer_pool_new();
+    GstStructure *config = gst_buffer_pool_get_config(pool);
+    gst_buffer_pool_config_set_params(config, caps, bufferSize, maxBuffers, maxBuffers);
+    MY_ASSERT(gst_buffer_pool_set_config(pool, config));
+    MY_ASSERT(gst_buffer_pool_set_active(pool, TRUE));
+    return pool;
+}
+
+//======================================================================================================================
+GstBuffer *acquireElfBuffer(GstBufferPool *pool, gsize bufferSize, std::atomic_int &hits, std::atomic_int &misses) {
+    if (pool != nullptr) {
+        // Never block here: the buffers we wait for might be stuck in the elf queues
+        GstBufferPoolAcquireParams params{};
+        params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+        GstBuffer *buffer = nullptr;
+        if (gst_buffer_pool_acquire_buffer(pool, &buffer, &params) == GST_FLOW_OK) {
+            if (gst_buffer_get_size(buffer) >= bufferSize) {
+                // The pool restores the full size when the buffer comes back
+                gst_buffer_set_size(buffer, bufferSize);
+                ++hits;
+                return buffer;
+            }
+            gst_buffer_unref(buffer);
+        }
+    }
+    ++misses;
+    return gst_buffer_new_and_alloc(bufferSize);
+}
+
+//======================================================================================================================
+void destroyElfPool(GstBufferPool *&pool) {
+    if (pool != nullptr) {
+        gst_buffer_pool_set_active(pool, FALSE);
+        gst_object_unref(pool);
+        pool = nullptr;
+    }
+}
+
+//======================================================================================================================
+bool parseIntArg(const std::string &s, long long &value, long long minValue, long long maxValue) {
+    const char *str = s.c_str();
+    char *end = nullptr;
+    errno = 0;
+    long long v = strtoll(str, &end, 10);
+    if (end == str || *end != '\0' || errno == ERANGE || v < minValue || v > maxValue)
+        return false;
+    value = v;
+    return true;
+}
+
+//======================================================================================================================
+bool parseIntArg(const std::string &s, int &value, int minValue, int maxValue) {
+    long long v;
+    if (!parseIntArg(s, v, minValue, maxValue))
+        return false;
+    value = int(v);
+    return true;
+}
+
+//======================================================================================================================
+bool parseBridgeOption(BridgeOptions &opts, int &i, int argc, char **argv) {
+    std::string arg(argv[i]);
+    bool hasValue = i + 1 < argc;
+    // A numeric option takes the next argument, a bad one is reported and skipped, the option keeps its default
+    auto intValue = [&](int &value) {
+        if (!parseIntArg(argv[++i], value))
+            std::cout << "Bad value for " << arg << " : " << argv[i] << std::endl;
+    };
+    int inFlight = int(opts.maxInFlight);
+    long long maxBytes = (long long) opts.maxBytes;
+    if (arg == "--poll")
+        opts.poll = true;
+    else if (arg == "--callbacks")
+        opts.useCallbacks = true;
+    else if (arg == "--workers" && hasValue)
+        intValue(opts.numWorkers);
+    else if (arg == "--in-flight" && hasValue) {
+        intValue(inFlight);
+        opts.maxInFlight = inFlight;
+    } else if (arg == "--batch" && hasValue)
+        intValue(opts.batchSize);
+    else if (arg == "--batch-wait" && hasValue)
+        intValue(opts.batchWaitMs);
+    else if (arg == "--buffer-list")
+        opts.useBufferList = true;
+    else if (arg == "--pool" && hasValue)
+        intValue(opts.poolSize);
+    else if (arg == "--max-buffers" && hasValue)
+        intValue(opts.maxBuffers);
+    else if (arg == "--max-bytes" && hasValue) {
+        if (parseIntArg(argv[++i], maxBytes, 0, LLONG_MAX))
+            opts.maxBytes = guint64(maxBytes);
+        else
+            std::cout << "Bad value for " << arg << " : " << argv[i] << std::endl;
+    } else if (arg == "--queue" && hasValue) {
+        if (!parseQueueSpec(opts, argv[++i]))
+            std::cout << "Bad value for " << arg << " : " << argv[i] << std::endl;
+    } else if (arg == "--fast-start")
+        opts.fastStart = true;
+    else if (arg == "--trace")
+        opts.trace = true;
+    else if (arg == "--trace-every" && hasValue) {
+        opts.trace = true;
+        intValue(opts.tracePeriodMs);
+    } else if (arg == "--interleave-stall" && hasValue)
+        intValue(opts.interleaveStallMs);
+    else if (arg == "--log-level" && hasValue) {
+        // The log level is global, not per stream
+        LogLevel level;
+        if (logParseLevel(argv[++i], level))
+            logSetLevel(level);
+        else
+            std::cout << "Bad value for " << arg << " : " << argv[i] << std::endl;
+    } else
+        return false;
+    return true;
+}
+
+//======================================================================================================================
+bool parseQueueSpec(BridgeOptions &opts, const std::string &spec) {
+    size_t pos = spec.find(':');
+    std::string policy = pos == std::string::npos ? "block" : spec.substr(pos + 1);
+    if (policy != "block" && policy != "drop")
+        return false;
+    int depth;
+    if (!parseIntArg(spec.substr(0, pos), depth))
+        return false;
+    opts.queueDepth = depth;
+    opts.queueDrop = policy == "drop";
+    return true;
+}
+
+//======================================================================================================================
+void printBridgeUsage() {
+    using namespace std;
+    cout << "Bridge options:" << endl;
+    cout << "  --poll : wait for need-data by polling every 10 ms (old behavior, for comparison)" << endl;
+    cout << "  --callbacks : process samples in appsink callbacks, no processing threads" << endl;
+    cout << "  --workers <n> : process buffers in n parallel workers, push them in the original order" << endl;
+    cout << "  --in-flight <n> : max buffers in the parallel stage, default 2 per worker" << endl;
+    cout << "  --batch <n> : pull and process in batches of up to n samples (not with --callbacks or --workers)" << endl;
+    cout << "  --batch-wait <ms> : max time to wait for a full batch, default 10 ms" << endl;
+    cout << "  --buffer-list : push each batch to ELF as one buffer list" << endl;
+    cout << "  --pool <n> : take output buffers for copies from a pool of n buffers" << endl;
+    cout << "  --max-buffers <n> : goblin appsink max-buffers" << endl;
+    cout << "  --max-bytes <n> : elf appsrc max-bytes" << endl;
+    cout << "  --queue <n>[:drop] : pull the goblin appsink into a queue of n samples in a thread of its own; when it's full," << endl;
+    cout << "                       block (default) or drop the new sample (not with --callbacks or --batch)" << endl;
+    cout << "  --fast-start : pre-roll elf while goblin starts, set the elf caps from the goblin caps event, not the first sample" << endl;
+    cout << "  --trace : trace the latency of each buffer from appsink pull to the elf sink, print at the end" << endl;
+    cout << "  --trace-every <ms> : same as --trace, and also print the latency histograms every <ms>" << endl;
+    cout << "  --interleave-stall <ms> : A/V interleaving, don't wait for a stream which has not pushed for <ms>, default 200" << endl;
+    cout << "  --log-level <debug|info|warn|error> : default info, debug needs a build with -DBRIDGE_LOG_DEBUG=ON" << endl;
+}
+
+//======================================================================================================================
+const char *bridgeVideoCaps(bool bgr) {
+    // The first format videoconvert can pass through wins, BGR is the fallback for everything else
+    return bgr ? "video/x-raw,format=BGR" : "video/x-raw,format=(string){ I420, NV12, BGR }";
+}
+
+//======================================================================================================================
+std::string elfFileBranchVideo(const std::string &fileName, const std::string &elfSinkName) {
+    auto endsWith = [&fileName](const char *ext) {
+        size_t n = strlen(ext);
+        return fileName.size() >= n && fileName.compare(fileName.size() - n, n, ext) == 0;
+    };
+    std::string sink = " ! filesink location=" + fileName + " sync=false";
+    if (endsWith(".y4m"))
+        return "videoconvert ! y4menc name=" + elfSinkName + sink;
+    // x264enc wants I420 or NV12, the videoconvert is passthrough for the native formats
+    std::string enc = "videoconvert ! x264enc name=" + elfSinkName + " speed-preset=superfast ! h264parse ! ";
+    return enc + (endsWith(".mkv") ? "matroskamux" : "mp4mux") + sink;
+}
+
+//======================================================================================================================
+std::string elfFileBranchAudio(const std::string &fileName, const std::string &elfSinkName) {
+    std::string sink = " ! filesink location=" + fileName + " sync=false";
+    if (fileName.size() >= 4 && fileName.compare(fileName.size() - 4, 4, ".wav") == 0)
+        return "audioconvert ! wavenc name=" + elfSinkName + sink;
+    return "audioconvert ! vorbisenc name=" + elfSinkName + " ! oggmux" + sink;
+}
+
+//======================================================================================================================
+int countActiveConversions(GstElement *pipeline) {
+    int count = 0;
+    GstIterator *it = gst_bin_iterate_recurse(GST_BIN(pipeline));
+    GValue item = G_VALUE_INIT;
+    for (;;) {
+        GstIteratorResult res = gst_iterator_next(it, &item);
+        if (res == GST_ITERATOR_RESYNC) {
+            count = 0;
+            gst_iterator_resync(it);
+            continue;
+        }
+        if (res != GST_ITERATOR_OK)
+            break;
+        GstElement *element = GST_ELEMENT(g_value_get_object(&item));
+        GstElementFactory *factory = gst_element_get_factory(element);
+        const gchar *name = factory ? gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)) : nullptr;
+        if (name && (strcmp(name, "videoconvert") == 0 || strcmp(name, "videoconvertscale") == 0) &&
+            !gst_base_transform_is_passthrough(GST_BASE_TRANSFORM(element)))
+            ++count;
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+    return count;
+}
+
+//======================================================================================================================
+/// The queue element right after the appsrc, with our own reference, or nullptr
+static GstElement *findElfQueue(GstElement *elfSrc) {
+    GstElement *queue = nullptr;
+    GstPad *pad = gst_element_get_static_pad(elfSrc, "src");
+    GstPad *peer = pad ? gst_pad_get_peer(pad) : nullptr;
+    if (peer) {
+        queue = gst_pad_get_parent_element(peer);
+        GstElementFactory *factory = queue ? gst_element_get_factory(queue) : nullptr;
+        if (factory == nullptr || strcmp(gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)), "queue") != 0) {
+            if (queue)
+                gst_object_unref(queue);
+            queue = nullptr;
+        }
+        gst_object_unref(peer);
+    }
+    if (pad)
+        gst_object_unref(pad);
+    return queue;
+}
+
+//======================================================================================================================
+GstBuffer *forwardBuffer(GstSample *sample) {
+    GstBuffer *buffer = gst_buffer_ref(gst_sample_get_buffer(sample));
+    gst_sample_unref(sample);
+    return buffer;
+}
+
+//======================================================================================================================
+GstBuffer *writableBuffer(BridgeStream &stream, GstSample *sample) {
+    // Take our own reference to the buffer and release the sample
+    GstBuffer *buffer = gst_buffer_ref(gst_sample_get_buffer(sample));
+    gst_sample_unref(sample);
+    if (!gst_buffer_is_writable(buffer))
+        ++stream.countWritableCopies;
+    return gst_buffer_make_writable(buffer);
+}
+
+//======================================================================================================================
+GstBuffer *copyBuffer(BridgeStream &stream, GstSample *sample) {
+    GstBuffer *bufferIn = gst_sample_get_buffer(sample);
+    GstMapInfo mapIn;
+    MY_ASSERT(gst_buffer_map(bufferIn, &mapIn, GST_MAP_READ));
+    GstBuffer *bufferOut = acquireElfBuffer(stream.pool, mapIn.size, stream.poolHits, stream.poolMisses);
+    GstMapInfo mapOut;
+    MY_ASSERT(gst_buffer_map(bufferOut, &mapOut, GST_MAP_WRITE));
+    memcpy(mapOut.data, mapIn.data, mapIn.size);
+    gst_buffer_unmap(bufferOut, &mapOut);
+    gst_buffer_unmap(bufferIn, &mapIn);
+    // Copy the input packet timestamp and duration
+    bufferOut->pts = bufferIn->pts;
+    bufferOut->duration = bufferIn->duration;
+    // And the metas: GstVideoMeta has the plane offsets and strides, if the decoder padded its planes
+    gst_buffer_copy_into(bufferOut, bufferIn, GST_BUFFER_COPY_META, 0, -1);
+    gst_sample_unref(sample);
+    return bufferOut;
+}
+
+//======================================================================================================================
+void processFrameInvertRoi(GstVideoFrame &frame) {
+    const GstVideoFormatInfo *finfo = frame.info.finfo;
+    int numPlanes = GST_VIDEO_FRAME_N_PLANES(&frame);
+    KernelPlane planes[GST_VIDEO_MAX_PLANES];
+    // Each plane takes its pixel stride and subsampling from the first component stored in it
+    for (int c = GST_VIDEO_FRAME_N_COMPONENTS(&frame) - 1; c >= 0; --c) {
+        KernelPlane &plane = planes[GST_VIDEO_FORMAT_INFO_PLANE(finfo, c)];
+        plane.pixelStride = GST_VIDEO_FORMAT_INFO_PSTRIDE(finfo, c);
+        plane.shiftW = GST_VIDEO_FORMAT_INFO_W_SUB(finfo, c);
+        plane.shiftH = GST_VIDEO_FORMAT_INFO_H_SUB(finfo, c);
+    }
+    for (int p = 0; p < numPlanes; ++p) {
+        planes[p].data = (uint8_t *) GST_VIDEO_FRAME_PLANE_DATA(&frame, p);
+        planes[p].stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, p);
+    }
+    int imW = GST_VIDEO_FRAME_WIDTH(&frame), imH = GST_VIDEO_FRAME_HEIGHT(&frame);
+    kernelInvertRect(planes, numPlanes, imW / 3, imH / 3, imW / 3, imH / 3);
+}
+
+//======================================================================================================================
+GstBuffer *processBufferInvertRoi(BridgeStream &stream, GstSample *sample, bool inPlace) {
+    // In-place: the goblin buffer itself, no copies
+    // Copy: a pool buffer with a copy of the frame, the goblin buffer stays intact
+    GstBuffer *buffer = inPlace ? writableBuffer(stream, sample) : copyBuffer(stream, sample);
+
+    // Map all planes for both reading and writing, with the plane offsets and strides of the buffer (GstVideoMeta)
+    // or of the caps, parsed by the engine once per caps change
+    GstVideoFrame frame;
+    if (!gst_video_frame_map(&frame, &stream.videoInfo, buffer, GST_MAP_READWRITE)) {
+        LOG_WARN << stream.prefix << "Cannot map the frame, buffer size = " << gst_buffer_get_size(buffer) << ", skipped";
+        return buffer;
+    }
+    processFrameInvertRoi(frame);
+    gst_video_frame_unmap(&frame);
+    return buffer;
+}
+
+//======================================================================================================================
+void processBatchInvertRoi(BridgeStream &stream, std::vector<GstSample *> &samples,
+                           std::vector<GstBuffer *> &buffersOut, bool inPlace) {
+    using namespace std;
+    // Map the whole batch first, then run the kernel over all frames in one pass while the kernel code
+    // and the (same) frame layout stay hot, then unmap; all frames of a batch have the same caps
+    vector<GstVideoFrame> frames(samples.size());
+    vector<bool> mapped(samples.size());
+    for (size_t i = 0; i < samples.size(); ++i) {
+        GstBuffer *buffer = inPlace ? writableBuffer(stream, samples[i]) : copyBuffer(stream, samples[i]);
+        mapped[i] = gst_video_frame_map(&frames[i], &stream.videoInfo, buffer, GST_MAP_READWRITE);
+        if (!mapped[i])
+            LOG_WARN << stream.prefix << "Cannot map the frame, buffer size = " << gst_buffer_get_size(buffer) <<
+                     ", skipped";
+        buffersOut.push_back(buffer);
+    }
+    for (size_t i = 0; i < frames.size(); ++i)
+        if (mapped[i])
+            processFrameInvertRoi(frames[i]);
+    for (size_t i = 0; i < frames.size(); ++i)
+        if (mapped[i])
+            gst_video_frame_unmap(&frames[i]);
+}
+
+//======================================================================================================================
+BridgeEngine::BridgeEngine(const std::string &goblinDesc, const std::string &elfDesc) {
+    GError *err = nullptr;
+    if (!goblinDesc.empty()) {
+        goblinPipeline = gst_parse_launch(goblinDesc.c_str(), &err);
+        checkErr(err);
+        MY_ASSERT(goblinPipeline);
+    }
+    if (!elfDesc.empty()) {
+        elfPipeline = gst_parse_launch(elfDesc.c_str(), &err);
+        checkErr(err);
+        MY_ASSERT(elfPipeline);
+    }
+}
+
+//======================================================================================================================
+BridgeEngine::~BridgeEngine() {
+    for (auto &stream : streams) {
+        stream->trace.stopPeriodic();
+        destroyElfPool(stream->pool);
+        gst_caps_replace(&stream->caps, nullptr);
+        if (stream->goblinSink)
+            gst_object_unref(stream->goblinSink);
+        if (stream->elfSrc)
+            gst_object_unref(stream->elfSrc);
+        if (stream->elfSink)
+            gst_object_unref(stream->elfSink);
+        if (stream->interleave.elfQueue)
+            gst_object_unref(stream->interleave.elfQueue);
+    }
+    // Destroy the two pipelines
+    if (goblinPipeline) {
+        gst_element_set_state(goblinPipeline, GST_STATE_NULL);
+        gst_object_unref(goblinPipeline);
+    }
+    if (elfPipeline) {
+        gst_element_set_state(elfPipeline, GST_STATE_NULL);
+        gst_object_unref(elfPipeline);
+    }
+}
+
+//======================================================================================================================
+BridgeStream &BridgeEngine::addStream(const BridgeOptions &opts, const std::string &goblinSinkName,
+                                      const std::string &elfSrcName, const std::string &elfSinkName,
+                                      const std::string &prefix) {
+    using namespace std;
+    unique_ptr<BridgeStream> stream(new BridgeStream);
+    stream->engine = this;
+    stream->prefix = prefix;
+    stream->opts = opts;
+    stream->gate.poll = opts.poll;
+    stream->trace.enabled = opts.trace;
+    if (opts.batchSize > 0 && opts.numWorkers > 0) {
+        LOG_WARN << prefix << "--batch and --workers cannot be combined, using --batch";
+        stream->opts.numWorkers = 0;
+    }
+
+    if (!goblinSinkName.empty()) {
+        stream->goblinSink = gst_bin_get_by_name(GST_BIN (goblinPipeline), goblinSinkName.c_str());
+        MY_ASSERT(stream->goblinSink);
+    }
+    if (!elfSrcName.empty()) {
+        stream->elfSrc = gst_bin_get_by_name(GST_BIN (elfPipeline), elfSrcName.c_str());
+        MY_ASSERT(stream->elfSrc);
+        // Let the pipeline itself signal us when it wants data
+        g_signal_connect(stream->elfSrc, "need-data", G_CALLBACK(onNeedData), stream.get());
+        g_signal_connect(stream->elfSrc, "enough-data", G_CALLBACK(onEnoughData), stream.get());
+    }
+    if (!elfSinkName.empty()) {
+        stream->elfSink = gst_bin_get_by_name(GST_BIN (elfPipeline), elfSinkName.c_str());
+        MY_ASSERT(stream->elfSink);
+    }
+    streams.push_back(move(stream));
+    return *streams.back();
+}
+
+//======================================================================================================================
+void BridgeEngine::run() {
+    start();
+    wait();
+}
+
+//======================================================================================================================
+void BridgeEngine::start() {
+    using namespace std;
+    tStartNs = nowNs();
+    bool fastStart = false;
+    // The interleaving waits for the other streams, which a pool task must never do
+    if (workPool && interleaveSkewNs > 0) {
+        LOG_WARN << "A/V interleaving is not supported with the work pool, turned off";
+        interleaveSkewNs = 0;
+    }
+
+    for (auto &s : streams) {
+        BridgeStream &stream = *s;
+        BridgeOptions &opts = stream.opts;
+        // Tunables which override the pipeline descriptions
+        if (stream.goblinSink && opts.maxBuffers > 0)
+            g_object_set(stream.goblinSink, "max-buffers", guint(opts.maxBuffers), nullptr);
+        if (stream.elfSrc && opts.maxBytes > 0)
+            g_object_set(stream.elfSrc, "max-bytes", guint64(opts.maxBytes), nullptr);
+
+        // Latency tracing: the last timestamp is taken on the elf sink pad
+        if (opts.trace && stream.elfSink) {
+            stream.trace.attachSink(stream.elfSink);
+            if (opts.tracePeriodMs > 0)
+                stream.trace.startPeriodic(opts.tracePeriodMs, stream.prefix);
+        }
+
+        // The work pool replaces the workers and batches
+        if (workPool && stream.goblinSink && (opts.numWorkers > 0 || opts.batchSize > 0)) {
+            LOG_WARN << stream.prefix << "--workers and --batch are not used with the work pool";
+            opts.numWorkers = 0;
+            opts.batchSize = 0;
+        }
+
+        // Startup timing, and fast start: the elf caps from the goblin caps event
+        if (stream.elfSink)
+            addFirstOutputProbe(stream);
+        if (opts.fastStart && stream.goblinSink)
+            addCapsProbe(stream);
+        fastStart = fastStart || opts.fastStart;
+
+        // A/V interleaving: watch the level of the elf queue
+        if (interleaveSkewNs > 0 && stream.elfSrc && !stream.interleave.elfQueue)
+            stream.interleave.elfQueue = findElfQueue(stream.elfSrc);
+
+        // Goblin queue: not for callbacks (no thread to pull) and batches (they pull with a timeout)
+        if (stream.goblinSink && opts.queueDepth > 0 && (opts.useCallbacks || workPool || opts.batchSize > 0)) {
+            LOG_WARN << stream.prefix << "--queue is not used with callbacks, the work pool or batches";
+            opts.queueDepth = 0;
+        }
+        if (stream.goblinSink && opts.queueDepth > 0) {
+            stream.goblinQueue.reset(new SpscRing<GstSample *>(opts.queueDepth));
+            // The ring is the queue now, a short appsink queue is enough to pass the backpressure of a blocking ring
+            if (opts.maxBuffers == 0)
+                g_object_set(stream.goblinSink, "max-buffers", guint(2), nullptr);
+        }
+
+        // Parallel processing workers, if any
+        if (opts.numWorkers > 0)
+            startWorkers(stream);
+
+        // In the callback mode, the goblin streaming thread calls us for each sample
+        // In the work pool mode, it only schedules a pool task for the stream
+        // Callbacks must be set before the pipeline starts
+        if (stream.goblinSink && (opts.useCallbacks || workPool)) {
+            GstAppSinkCallbacks callbacks{};
+            callbacks.new_sample = workPool ? onNewSamplePool : onNewSample;
+            callbacks.eos = workPool ? onEosPool : onEos;
+            gst_app_sink_set_callbacks(GST_APP_SINK(stream.goblinSink), &callbacks, &stream, nullptr);
+        }
+        stream.tStartNs = nowNs();
+    }
+
+    // One bus dispatcher thread for both pipelines, or the shared one for many engines
+    if (busDispatcher) {
+        bus = busDispatcher;
+    } else {
+        ownBus.reset(new BusDispatcher);
+        bus = ownBus.get();
+    }
+    if (goblinPipeline)
+        bus->add(goblinPipeline, busPrefix + "GOBLIN");
+    if (elfPipeline)
+        bus->add(elfPipeline, busPrefix + "ELF");
+    bus->start();
+
+    // Fast start: ELF goes through NULL -> READY -> PAUSED (sinks opened, devices and windows created) in a thread
+    // of its own while Goblin starts, so that only the final PAUSED -> PLAYING is left for the first frame
+    if (fastStart && elfPipeline)
+        threads.emplace_back([this]{
+            prerollElf();
+        });
+
+    // Play the Goblin pipeline only (Elf will start when all streams have caps)
+    if (goblinPipeline)
+        MY_ASSERT(gst_element_set_state(goblinPipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE);
+
+    // Processing threads (from goblin appsinks to elf appsrcs) or sources, unless we use callbacks or the pool
+    for (auto &s : streams) {
+        BridgeStream *stream = s.get();
+        if (stream->source)
+            threads.emplace_back([this, stream]{
+                stream->source(*stream);
+                endStream(*stream);
+            });
+        else if (stream->goblinSink && !stream->opts.useCallbacks && !workPool) {
+            if (stream->goblinQueue)
+                threads.emplace_back([this, stream]{
+                    codeThreadQueue(*stream);
+                });
+            threads.emplace_back([this, stream]{
+                if (stream->opts.batchSize > 0)
+                    codeThreadBatch(*stream);
+                else
+                    codeThreadProcess(*stream);
+            });
+        }
+    }
+}
+
+//======================================================================================================================
+void BridgeEngine::wait() {
+    using namespace std;
+    // Wait for threads, then for EOS on both pipelines
+    for (thread &t : threads)
+        t.join();
+    threads.clear();
+    for (GstElement *pipeline : {goblinPipeline, elfPipeline})
+        if (pipeline) {
+            bus->waitDone(pipeline);
+            // Count while the caps are still negotiated
+            (pipeline == goblinPipeline ? conversionsGoblin : conversionsElf) = countActiveConversions(pipeline);
+            gst_element_set_state(pipeline, GST_STATE_NULL);
+            bus->remove(pipeline);
+        }
+    ownBus.reset();
+    bus = nullptr;
+    for (auto &s : streams) {
+        s->trace.stopPeriodic();
+        // Work pool mode: the drain task may still be finishing after the EOS
+        unique_lock<mutex> lock(s->mutexPending);
+        s->condPending.wait(lock, [&s]{ return s->countPending == 0; });
+    }
+}
+
+//======================================================================================================================
+void BridgeEngine::printStats() {
+    using namespace std;
+    // The log goes first, or it gets mixed with the statistics
+    logFlush();
+    cout << "Colorspace conversions per frame : goblin = " << conversionsGoblin << ", elf = " << conversionsElf << endl;
+    // Startup, all from start(): the time to first frame is "first output"
+    auto msSinceStart = [this](int64_t t) {
+        return t > 0 ? (t - tStartNs) * 1e-6 : -1;
+    };
+    if (elfPipeline)
+        cout << "Startup : ELF PLAYING at " << msSinceStart(tElfPlayNs) << " ms" << endl;
+    for (auto &s : streams) {
+        BridgeStream &stream = *s;
+        const string &prefix = stream.prefix;
+        if (stream.elfSrc)
+            feedGatePrintStats(stream.gate, prefix);
+        cout << prefix << "Startup" << (stream.opts.fastStart ? " (fast start)" : "") << " : elf caps = " <<
+             msSinceStart(stream.tInitNs) << " ms, first sample = " << msSinceStart(stream.tFirstSampleNs) << " ms";
+        if (stream.elfSink)
+            cout << ", first output = " << msSinceStart(stream.tFirstOutputNs) << " ms";
+        cout << endl;
+        if (stream.countCapsChanges > 0)
+            cout << prefix << "Caps changes : " << stream.countCapsChanges << endl;
+        if (stream.opts.batchSize > 0)
+            cout << prefix << "Batches : count = " << stream.countBatches << ", average size = " <<
+                 (stream.countBatches ? double(stream.countBatchFrames) / stream.countBatches : 0) << endl;
+        if (stream.goblinQueue) {
+            int64_t n = stream.countQueued;
+            cout << prefix << "Queue : depth = " << stream.opts.queueDepth << (stream.opts.queueDrop ? " (drop)" : " (block)") <<
+                 ", samples = " << n << ", dropped = " << stream.countQueueDropped << ", occupancy avg = " <<
+                 (n ? double(stream.sumQueueOccupancy) / n : 0) << ", max = " << stream.maxQueueOccupancy <<
+                 ", demuxer blocked = " << stream.countQueueBlocked << " times, " << stream.queueBlockNs * 1e-6 <<
+                 " ms, max = " << stream.queueBlockMaxNs * 1e-6 << " ms, processing waited = " <<
+                 stream.queueWaitNs * 1e-6 << " ms" << endl;
+        }
+        if (stream.opts.numWorkers > 0) {
+            const WorkerStage &stage = stream.stage;
+            uint64_t n = stage.seqOut;
+            cout << prefix << "Workers : buffers = " << n << ", queue depth avg = " <<
+                 (n ? double(stage.sumQueueDepth) / n : 0) << ", max = " << stage.maxQueueDepth <<
+                 ", reorder buffer max = " << stage.maxReorderDepth << ", reorder latency avg = " <<
+                 (n ? stage.sumReorderNs * 1e-3 / n : 0) << " us, max = " << stage.maxReorderNs * 1e-3 << " us" << endl;
+        }
+        if (interleaveSkewNs > 0 && stream.elfSrc) {
+            const InterleaveState &st = stream.interleave;
+            int64_t n = st.countPushes;
+            cout << prefix << "Interleave : pushes = " << n << ", waits = " << st.countWaits << ", waited = " <<
+                 st.waitNs * 1e-6 << " ms, past a stalled stream = " << st.countStallSkips << ", skew avg = " <<
+                 (n ? st.sumSkewNs * 1e-6 / n : 0) << " ms, max = " << st.maxSkewNs * 1e-6 << " ms";
+            if (st.elfQueue)
+                cout << ", elf queue avg = " << (n ? st.sumQueueNs * 1e-6 / n : 0) << " ms, max = " <<
+                     st.maxQueueNs * 1e-6 << " ms";
+            cout << endl;
+        }
+        if (stream.elfSrc)
+            cout << prefix << "Output buffers : forwarded = " << stream.countForwarded << ", make_writable() copies = " <<
+                 stream.countWritableCopies << ", pool hits = " << stream.poolHits << ", misses = " <<
+                 stream.poolMisses << endl;
+        if (stream.countPushed > 0 && stream.tEndNs > stream.tStartNs && stream.mediaStartNs >= 0) {
+            double mediaSec = (stream.mediaEndNs - stream.mediaStartNs) * 1e-9;
+            double wallSec = (stream.tEndNs - stream.tStartNs) * 1e-9;
+            cout << prefix << "Speed : media = " << mediaSec << " s, wall = " << wallSec << " s, " <<
+                 mediaSec / wallSec << " x realtime" << endl;
+        }
+        if (stream.opts.trace)
+            stream.trace.print(cout, prefix);
+    }
+}
+
+//======================================================================================================================
+void BridgeEngine::startElf() {
+    using namespace std;
+    lock_guard<mutex> lock(mutexElfStart);
+    // We check again under mutex, the start code runs only once strictly !
+    if (flagElfStarted)
+        return;
+    for (auto &s : streams)
+        if (s->elfSrc && !s->flagInit)
+            return;
+    LOG_INFO << "PLAYELF !!!! PLAYELF !!!! PLAYELF !!!! ";
+    tElfPlayNs = nowNs();
+    GstStateChangeReturn ret = gst_element_set_state(elfPipeline, GST_STATE_PLAYING);
+    MY_ASSERT(ret != GST_STATE_CHANGE_FAILURE);
+    flagElfStarted = true;
+}
+
+//======================================================================================================================
+/// Fast start: take ELF to PAUSED before the first sample, unless it's already playing
+/// PAUSED does not complete until the sinks pre-roll on the first buffers, set_state() returns ASYNC then
+/// set_state() runs without mutexElfStart: the caps event probe takes it in startElf() on the goblin streaming
+/// thread, which the state change can wait for
+void BridgeEngine::prerollElf() {
+    using namespace std;
+    {
+        lock_guard<mutex> lock(mutexElfStart);
+        if (flagElfStarted)
+            return;
+    }
+    int64_t t0 = nowNs();
+    GstStateChangeReturn ret = gst_element_set_state(elfPipeline, GST_STATE_PAUSED);
+    MY_ASSERT(ret != GST_STATE_CHANGE_FAILURE);
+    {
+        // startElf() may have run in between: PAUSED must not override PLAYING
+        lock_guard<mutex> lock(mutexElfStart);
+        if (flagElfStarted) {
+            ret = gst_element_set_state(elfPipeline, GST_STATE_PLAYING);
+            MY_ASSERT(ret != GST_STATE_CHANGE_FAILURE);
+            return;
+        }
+    }
+    LOG_INFO << "ELF pre-rolled to PAUSED in " << (nowNs() - t0) * 1e-6 << " ms";
+}
+
+//======================================================================================================================
+/// Set the caps of the elf appsrc, appsrc sends them downstream in order with the buffers
+static void setElfCaps(BridgeStream &stream, GstCaps *caps) {
+    if (stream.elfSrc == nullptr)
+        return;
+    // Make a copy to be safe (probably not needed)
+    GstCaps *capsElf = gst_caps_copy(caps);
+    g_object_set(stream.elfSrc, "caps", capsElf, nullptr);
+    gst_caps_unref(capsElf);
+}
+
+//======================================================================================================================
+void BridgeEngine::initElf(BridgeStream &stream, GstCaps *caps) {
+    if (stream.flagInit)
+        return;
+    setElfCaps(stream, caps);
+    stream.tInitNs = nowNs();
+    stream.flagInit = true;
+    // Play ELF only after ALL streams are initialized !
+    if (elfPipeline)
+        startElf();
+}
+
+//======================================================================================================================
+/// Check the caps of a goblin sample: initialize the stream from the first sample, re-negotiate on caps change
+/// Normally the caps object is the same as for the previous sample, then this is a single pointer comparison
+void BridgeEngine::initStream(BridgeStream &stream, GstSample *sample) {
+    GstCaps *caps = gst_sample_get_caps(sample);
+    MY_ASSERT(caps != nullptr);
+    if (caps == stream.caps)
+        return;
+    bool first = stream.caps == nullptr;
+    bool same = !first && gst_caps_is_equal(caps, stream.caps);
+    gst_caps_replace(&stream.caps, caps);
+    if (same)
+        return;
+
+    if (!first) {
+        ++stream.countCapsChanges;
+        gchar *str = gst_caps_to_string(caps);
+        LOG_INFO << stream.prefix << "Caps changed : " << str;
+        g_free(str);
+        // Buffers with the old caps must reach ELF before the new caps, and no worker may use the old info or pool
+        if (stream.opts.numWorkers > 0)
+            drainWorkers(stream);
+    }
+
+    // Parse the caps once here, instead of for every buffer
+    stream.isVideo = gst_structure_has_name(gst_caps_get_structure(caps, 0), "video/x-raw") &&
+                     gst_video_info_from_caps(&stream.videoInfo, caps);
+    if (stream.init)
+        stream.init(stream, sample);
+
+    // (Re)create the output buffer pool for the new caps, if needed
+    // Buffers of the old pool still in the elf pipeline keep it alive until they are released
+    if (stream.elfSrc && stream.opts.poolSize > 0) {
+        gsize size = stream.isVideo ? GST_VIDEO_INFO_SIZE(&stream.videoInfo) :
+                     gsize(gst_buffer_get_size(gst_sample_get_buffer(sample)) * stream.poolMargin);
+        destroyElfPool(stream.pool);
+        stream.pool = createElfPool(caps, guint(size), stream.opts.poolSize);
+    }
+
+    // Use sample caps verbatim to ELF appsrc and re-negotiate
+    // Fast start: the elf caps are already set from the caps event, normally the very same caps
+    if (first && !stream.flagInit) {
+        initElf(stream, caps);
+    } else if (first) {
+        GstCaps *capsElf = stream.elfSrc ? gst_app_src_get_caps(GST_APP_SRC(stream.elfSrc)) : nullptr;
+        if (capsElf == nullptr || !gst_caps_is_equal(caps, capsElf))
+            setElfCaps(stream, caps);
+        if (capsElf)
+            gst_caps_unref(capsElf);
+    } else {
+        setElfCaps(stream, caps);
+    }
+}
+
+//======================================================================================================================
+/// Process one sample, return the output buffer for the elf appsrc
+GstBuffer *BridgeEngine::processBuffer(BridgeStream &stream, GstSample *sample) {
+    stream.trace.mark(TracePoint::PROC_START, sample);
+    GstBuffer *buffer;
+    if (stream.passthrough || !stream.process) {
+        ++stream.countForwarded;
+        buffer = forwardBuffer(sample);
+    } else {
+        buffer = stream.process(stream, sample);
+    }
+    if (buffer != nullptr)
+        stream.trace.mark(TracePoint::PROC_END, buffer);
+    return buffer;
+}
+
+//======================================================================================================================
+/// Process one sample and send the result to the elf appsrc
+void BridgeEngine::processSample(BridgeStream &stream, GstSample *sample) {
+    initStream(stream, sample);
+    push(stream, processBuffer(stream, sample));
+}
+
+//======================================================================================================================
+void BridgeEngine::processBatch(BridgeStream &stream, std::vector<GstSample *> &samples,
+                                std::vector<GstBuffer *> &buffersOut) {
+    if (stream.processBatch && !stream.passthrough) {
+        for (GstSample *sample : samples)
+            stream.trace.mark(TracePoint::PROC_START, sample);
+        stream.processBatch(stream, samples, buffersOut);
+        for (GstBuffer *buffer : buffersOut)
+            stream.trace.mark(TracePoint::PROC_END, buffer);
+    } else {
+        for (GstSample *sample : samples) {
+            GstBuffer *buffer = processBuffer(stream, sample);
+            if (buffer != nullptr)
+                buffersOut.push_back(buffer);
+        }
+    }
+    samples.clear();
+}
+
+//======================================================================================================================
+/// Statistics of a buffer about to be pushed to ELF
+static void countPushedBuffer(BridgeStream &stream, GstBuffer *buffer) {
+    stream.trace.mark(TracePoint::PUSH, buffer);
+    ++stream.countPushed;
+    stream.bytesPushed += gst_buffer_get_size(buffer);
+    if (GST_BUFFER_PTS_IS_VALID(buffer)) {
+        int64_t pts = GST_BUFFER_PTS(buffer);
+        if (stream.mediaStartNs < 0)
+            stream.mediaStartNs = pts;
+        int64_t end = pts + (GST_BUFFER_DURATION_IS_VALID(buffer) ? GST_BUFFER_DURATION(buffer) : 0);
+        if (end > stream.mediaEndNs)
+            stream.mediaEndNs = end;
+    }
+}
+
+//======================================================================================================================
+/// Push a batch of buffers to the elf appsrc, as a single buffer list or one by one
+void BridgeEngine::pushBatch(BridgeStream &stream, std::vector<GstBuffer *> &buffers) {
+    if (stream.elfSrc == nullptr || stream.flagElfEnd) {
+        for (GstBuffer *buffer : buffers)
+            gst_buffer_unref(buffer);
+    } else if (stream.opts.useBufferList) {
+        // The list takes ownership of the buffers, and appsrc takes ownership of the list
+        // The whole list goes at once, so it waits for its last (latest) buffer
+        if (!buffers.empty())
+            interleaveWait(stream, buffers.back());
+        GstBufferList *list = gst_buffer_list_new_sized(buffers.size());
+        for (GstBuffer *buffer : buffers) {
+            countPushedBuffer(stream, buffer);
+            gst_buffer_list_add(list, buffer);
+        }
+        GstFlowReturn ret = gst_app_src_push_buffer_list(GST_APP_SRC(stream.elfSrc), list);
+        if (ret != GST_FLOW_OK)
+            endElfFlow(stream, ret);
+    } else {
+        for (GstBuffer *buffer : buffers)
+            push(stream, buffer);
+    }
+    buffers.clear();
+}
+
+//======================================================================================================================
+void BridgeEngine::waitFeed(BridgeStream &stream) {
+    // We wait until ELF wants data, but only if this stream is initialized and ELF still takes it
+    if (stream.elfSrc && stream.flagInit && !stream.flagElfEnd)
+        feedGateWait(stream.gate, stream.prefix);
+}
+
+//======================================================================================================================
+void BridgeEngine::push(BridgeStream &stream, GstBuffer *buffer) {
+    if (buffer == nullptr)
+        return;
+    if (stream.elfSrc == nullptr || stream.flagElfEnd) {
+        gst_buffer_unref(buffer);
+        return;
+    }
+    interleaveWait(stream, buffer);
+    countPushedBuffer(stream, buffer);
+    // appsrc takes ownership of the buffer
+    GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(stream.elfSrc), buffer);
+    if (ret != GST_FLOW_OK)
+        endElfFlow(stream, ret);
+}
+
+//======================================================================================================================
+/// The elf appsrc has refused a buffer: it is flushing (ELF is stopping) or got EOS already
+/// The stream pushes nothing more, the rest of the goblin samples are dropped unprocessed,
+/// and nobody waits for this stream any more: neither its producer for need-data, nor the other streams
+void BridgeEngine::endElfFlow(BridgeStream &stream, GstFlowReturn ret) {
+    if (stream.flagElfEnd.exchange(true))
+        return;
+    LOG_WARN << stream.prefix << "ELF push : " << gst_flow_get_name(ret) << ", the stream ends here";
+    interleaveEnd(stream);
+    feedGateOpen(stream.gate);
+    if (workPool && stream.flagParked.exchange(false))
+        submitDrain(stream);
+}
+
+//======================================================================================================================
+/// A/V interleaving: wait until the buffer is at most interleaveSkewNs ahead of all the other streams
+/// A stream which has not moved for opts.interleaveStallMs (stuck, or starved by the demuxer) is not waited for,
+/// so the others never stall on it for longer than that
+/// Blocks, so it's for the processing threads and workers only, start() turns it off with the work pool
+void BridgeEngine::interleaveWait(BridgeStream &stream, GstBuffer *buffer) {
+    using namespace std;
+    if (interleaveSkewNs <= 0 || !GST_BUFFER_PTS_IS_VALID(buffer))
+        return;
+    int64_t pts = GST_BUFFER_PTS(buffer);
+    InterleaveState &st = stream.interleave;
+    unique_lock<mutex> lock(mutexInterleave);
+    interleaveUpdate(stream, pts);
+
+    bool flagWaited = false;
+    int64_t t0 = st.tUpdateNs;
+    for (;;) {
+        int64_t tRetryNs = interleaveTry(stream, pts, flagWaited);
+        if (tRetryNs == 0)
+            break;
+        // Too far ahead: wait until the slowest one pushes, or is considered stalled
+        flagWaited = true;
+        condInterleave.wait_for(lock, chrono::nanoseconds(max<int64_t>(tRetryNs - nowNs(), 0) + 1000));
+    }
+    if (flagWaited) {
+        ++st.countWaits;
+        st.waitNs += nowNs() - t0;
+    }
+}
+
+//======================================================================================================================
+/// A/V interleaving, under mutexInterleave: the stream is about to push a buffer with this PTS,
+/// the others may now go up to this PTS + skew
+void BridgeEngine::interleaveUpdate(BridgeStream &stream, int64_t pts) {
+    stream.interleave.pts = pts;
+    stream.interleave.tUpdateNs = nowNs();
+    condInterleave.notify_all();
+}
+
+//======================================================================================================================
+/// A/V interleaving, under mutexInterleave: can the stream push its buffer with this PTS now ?
+/// Returns 0 if it can, and counts the push; otherwise the time (nowNs()) to try again at, when the slowest other
+/// stream is considered stalled if it does not move; flagWaited = it has waited for this buffer already
+int64_t BridgeEngine::interleaveTry(BridgeStream &stream, int64_t pts, bool flagWaited) {
+    using namespace std;
+    InterleaveState &st = stream.interleave;
+    int64_t stallNs = int64_t(stream.opts.interleaveStallMs) * 1000000;
+    // The slowest other stream, which is not ended or stalled
+    int64_t now = nowNs();
+    int64_t ptsMin = -1;
+    int64_t tStallNs = 0;
+    bool flagStalled = false;
+    for (auto &s : streams) {
+        const InterleaveState &o = s->interleave;
+        if (s.get() == &stream || o.pts < 0)
+            continue;
+        if (now - o.tUpdateNs > stallNs) {
+            flagStalled = true;
+            continue;
+        }
+        if (ptsMin < 0 || o.pts < ptsMin) {
+            ptsMin = o.pts;
+            tStallNs = o.tUpdateNs + stallNs;
+        }
+    }
+    if (ptsMin >= 0 && pts > ptsMin + interleaveSkewNs)
+        return max<int64_t>(tStallNs, 1);
+
+    if (flagStalled && flagWaited)
+        ++st.countStallSkips;
+    ++st.countPushes;
+    if (ptsMin >= 0) {
+        int64_t skew = pts - ptsMin;
+        st.sumSkewNs += skew;
+        st.maxSkewNs = max(st.maxSkewNs, skew);
+    }
+    if (st.elfQueue) {
+        guint64 level = 0;
+        g_object_get(st.elfQueue, "current-level-time", &level, nullptr);
+        st.sumQueueNs += level;
+        st.maxQueueNs = max<uint64_t>(st.maxQueueNs, level);
+    }
+    return 0;
+}
+
+//======================================================================================================================
+/// A/V interleaving: the stream has ended, it does not hold the others back any more
+void BridgeEngine::interleaveEnd(BridgeStream &stream) {
+    if (interleaveSkewNs <= 0)
+        return;
+    std::lock_guard<std::mutex> lock(mutexInterleave);
+    stream.interleave.pts = -1;
+    condInterleave.notify_all();
+}
+
+//======================================================================================================================
+/// A sample has just been pulled from the goblin appsink (or fed by a source): trace and record it
+static void pulledSample(BridgeStream &stream, GstSample *sample) {
+    if (stream.tFirstSampleNs == 0)
+        stream.tFirstSampleNs = nowNs();
+    stream.trace.mark(TracePoint::PULL, sample);
+    if (stream.recorder)
+        stream.recorder->write(sample);
+}
+
+//======================================================================================================================
+void BridgeEngine::feed(BridgeStream &stream, GstSample *sample) {
+    dispatchSample(stream, sample);
+}
+
+//======================================================================================================================
+/// A sample from the goblin appsink: process it right here or give it to the workers
+void BridgeEngine::dispatchSample(BridgeStream &stream, GstSample *sample) {
+    pulledSample(stream, sample);
+    // ELF takes nothing more, don't waste the time on processing
+    if (stream.flagElfEnd) {
+        gst_sample_unref(sample);
+        return;
+    }
+    if (stream.opts.numWorkers > 0)
+        submitSample(stream, sample);
+    else
+        processSample(stream, sample);
+}
+
+//======================================================================================================================
+/// No more data: wait for the buffers still in the workers, then send EOS to ELF
+void BridgeEngine::endStream(BridgeStream &stream) {
+    if (stream.opts.numWorkers > 0)
+        stopWorkers(stream);
+    stream.tEndNs = nowNs();
+    interleaveEnd(stream);
+    if (stream.elfSrc)
+        gst_app_src_end_of_stream(GST_APP_SRC(stream.elfSrc));
+}
+
+//======================================================================================================================
+/// Goblin queue thread: pull the goblin appsink into the ring, never waits for the elf gate
+/// The appsink (and the demuxer behind it) waits only if the ring is full in the blocking mode
+void BridgeEngine::codeThreadQueue(BridgeStream &stream) {
+    GstAppSink *sink = GST_APP_SINK(stream.goblinSink);
+    SpscRing<GstSample *> &ring = *stream.goblinQueue;
+    for (;;) {
+        // nullptr = EOS
+        GstSample *sample = gst_app_sink_pull_sample(sink);
+        if (sample == nullptr)
+            break;
+        size_t occupancy = ring.size();
+        ++stream.countQueued;
+        stream.sumQueueOccupancy += occupancy;
+        if (occupancy > stream.maxQueueOccupancy)
+            stream.maxQueueOccupancy = occupancy;
+        if (!stream.opts.queueDrop) {
+            int64_t blockedNs = ring.push(sample);
+            if (blockedNs > 0) {
+                // The ring is full: the demuxer (and every other stream of it) waits for this stream's processing
+                ++stream.countQueueBlocked;
+                stream.queueBlockNs += blockedNs;
+                if (blockedNs > stream.queueBlockMaxNs)
+                    stream.queueBlockMaxNs = blockedNs;
+            }
+        } else if (!ring.tryPush(sample)) {
+            // The processing is behind: drop this sample rather than stall the demuxer
+            gst_sample_unref(sample);
+            ++stream.countQueueDropped;
+            LOG_DEBUG << stream.prefix << "Queue full, sample dropped";
+        }
+    }
+    ring.close();
+}
+
+//======================================================================================================================
+/// Take samples from the goblin appsink (or its queue), process, send to the elf appsrc
+void BridgeEngine::codeThreadProcess(BridgeStream &stream) {
+    using namespace std;
+    GstAppSink *sink = GST_APP_SINK(stream.goblinSink);
+    for (;;) {
+        waitFeed(stream);
+
+        GstSample *sample = nullptr;
+        if (stream.goblinQueue) {
+            // The queue is closed and empty after Goblin EOS
+            int64_t waitedNs;
+            if (!stream.goblinQueue->pop(sample, waitedNs)) {
+                LOG_INFO << stream.prefix << "GOBLIN EOS !";
+                break;
+            }
+            stream.queueWaitNs += waitedNs;
+        } else {
+            // Check for Goblin EOS
+            if (gst_app_sink_is_eos(sink)) {
+                LOG_INFO << stream.prefix << "GOBLIN EOS !";
+                break;
+            }
+
+            // Pull the sample from Goblin appsink
+            sample = gst_app_sink_pull_sample(sink);
+            if (sample == nullptr) {
+                LOG_INFO << stream.prefix << "NO sample !";
+                break;
+            }
+        }
+        dispatchSample(stream, sample);
+    }
+    endStream(stream);
+}
+
+//======================================================================================================================
+/// Batch version of codeThreadProcess(): collect up to batchSize samples, process and push them together
+/// We wait as long as needed for the first sample of a batch, but at most batchWaitMs for the rest
+void BridgeEngine::codeThreadBatch(BridgeStream &stream) {
+    using namespace std;
+    GstAppSink *sink = GST_APP_SINK(stream.goblinSink);
+    const BridgeOptions &opts = stream.opts;
+    vector<GstSample *> samples;
+    vector<GstBuffer *> buffers;
+    samples.reserve(opts.batchSize);
+    buffers.reserve(opts.batchSize);
+
+    bool flagEos = false;
+    // The first sample with new caps ends a batch, and starts the next one
+    GstSample *sampleNext = nullptr;
+    while (!flagEos) {
+        waitFeed(stream);
+
+        // The first sample of the batch
+        GstSample *sample = sampleNext;
+        sampleNext = nullptr;
+        if (sample == nullptr) {
+            // Check for Goblin EOS
+            if (gst_app_sink_is_eos(sink)) {
+                LOG_INFO << stream.prefix << "GOBLIN EOS !";
+                break;
+            }
+            sample = gst_app_sink_pull_sample(sink);
+            if (sample == nullptr) {
+                LOG_INFO << stream.prefix << "NO sample !";
+                break;
+            }
+            pulledSample(stream, sample);
+        }
+        initStream(stream, sample);
+        samples.push_back(sample);
+
+        // The rest of the batch, until it's full or the time is up
+        int64_t deadlineNs = nowNs() + int64_t(opts.batchWaitMs) * 1000000;
+        while ((int) samples.size() < opts.batchSize) {
+            int64_t leftNs = deadlineNs - nowNs();
+            if (leftNs <= 0)
+                break;
+            sample = gst_app_sink_try_pull_sample(sink, leftNs);
+            if (sample == nullptr) {
+                // Either a timeout or EOS, process what we have in both cases
+                flagEos = gst_app_sink_is_eos(sink);
+                break;
+            }
+            pulledSample(stream, sample);
+            if (gst_sample_get_caps(sample) != stream.caps) {
+                sampleNext = sample;
+                break;
+            }
+            samples.push_back(sample);
+        }
+
+        ++stream.countBatches;
+        stream.countBatchFrames += samples.size();
+        processBatch(stream, samples, buffers);
+        pushBatch(stream, buffers);
+    }
+    endStream(stream);
+}
+
+//======================================================================================================================
+/// Parallel stage worker: process buffers from the queue, then push them to ELF in the original order
+void BridgeEngine::codeThreadWorker(BridgeStream &stream) {
+    using namespace std;
+    WorkerStage &stage = stream.stage;
+    for (;;) {
+        FrameJob job;
+        {
+            unique_lock<mutex> lock(stage.mutex);
+            stage.condJob.wait(lock, [&stage]{ return !stage.queue.empty() || stage.flagStop; });
+            // On stop, we still finish all the queued frames
+            if (stage.queue.empty())
+                break;
+            job = stage.queue.front();
+            stage.queue.pop_front();
+        }
+
+        // The expensive part, runs in all workers at once
+        job.buffer = processBuffer(stream, job.sample);
+        job.sample = nullptr;
+        job.tDoneNs = nowNs();
+
+        {
+            unique_lock<mutex> lock(stage.mutex);
+            stage.reorder[job.seq] = job;
+            stage.maxReorderDepth = max(stage.maxReorderDepth, stage.reorder.size());
+            // Push all frames which are next in order, whoever finished them
+            // One worker pushes at a time, which keeps the order; it pushes without the mutex, since push() can
+            // wait (A/V interleaving), and the other workers go on processing meanwhile
+            if (!stage.flagPushing) {
+                stage.flagPushing = true;
+                while (!stage.reorder.empty() && stage.reorder.begin()->first == stage.seqOut) {
+                    FrameJob next = stage.reorder.begin()->second;
+                    stage.reorder.erase(stage.reorder.begin());
+                    int64_t dt = nowNs() - next.tDoneNs;
+                    stage.sumReorderNs += dt;
+                    stage.maxReorderNs = max(stage.maxReorderNs, dt);
+                    lock.unlock();
+                    push(stream, next.buffer);
+                    lock.lock();
+                    ++stage.seqOut;
+                    stage.condSpace.notify_all();
+                }
+                stage.flagPushing = false;
+            }
+        }
+        stage.condSpace.notify_all();
+    }
+}
+
+//======================================================================================================================
+/// Start the parallel stage with opts.numWorkers worker threads
+void BridgeEngine::startWorkers(BridgeStream &stream) {
+    WorkerStage &stage = stream.stage;
+    stage.maxInFlight = stream.opts.maxInFlight > 0 ? stream.opts.maxInFlight : 2 * stream.opts.numWorkers;
+    for (int i = 0; i < stream.opts.numWorkers; ++i)
+        stage.workers.emplace_back([this, &stream]{
+            codeThreadWorker(stream);
+        });
+}
+
+//======================================================================================================================
+/// Send one sample to the parallel stage, block while too many frames are in flight
+/// Takes ownership of the sample
+void BridgeEngine::submitSample(BridgeStream &stream, GstSample *sample) {
+    using namespace std;
+    initStream(stream, sample);
+    WorkerStage &stage = stream.stage;
+    {
+        unique_lock<mutex> lock(stage.mutex);
+        stage.condSpace.wait(lock, [&stage]{ return stage.seqIn - stage.seqOut < stage.maxInFlight; });
+        FrameJob job;
+        job.seq = stage.seqIn++;
+        job.sample = sample;
+        stage.queue.push_back(job);
+        stage.maxQueueDepth = max(stage.maxQueueDepth, stage.queue.size());
+        stage.sumQueueDepth += stage.queue.size();
+    }
+    stage.condJob.notify_one();
+}
+
+//======================================================================================================================
+/// Finish all the frames in the parallel stage and stop the workers
+void BridgeEngine::stopWorkers(BridgeStream &stream) {
+    WorkerStage &stage = stream.stage;
+    {
+        std::lock_guard<std::mutex> lock(stage.mutex);
+        stage.flagStop = true;
+    }
+    stage.condJob.notify_all();
+    for (std::thread &t : stage.workers)
+        t.join();
+    stage.workers.clear();
+}
+
+//======================================================================================================================
+/// Wait until all the frames in the parallel stage are pushed to ELF
+void BridgeEngine::drainWorkers(BridgeStream &stream) {
+    WorkerStage &stage = stream.stage;
+    std::unique_lock<std::mutex> lock(stage.mutex);
+    stage.condSpace.wait(lock, [&stage]{ return stage.seqOut == stage.seqIn; });
+}
+
+//======================================================================================================================
+/// Appsink callback: a new sample is ready, runs on the goblin streaming thread
+/// This is an alternative to codeThreadProcess(), which needs no thread of its own
+GstFlowReturn BridgeEngine::onNewSample(GstAppSink *sink, gpointer userData) {
+    BridgeStream &stream = *(BridgeStream *) userData;
+    // Blocking here blocks the goblin streaming thread, which is exactly the backpressure we want
+    stream.engine->waitFeed(stream);
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (sample == nullptr)
+        return GST_FLOW_EOS;
+    stream.engine->dispatchSample(stream, sample);
+    // ELF takes nothing more: tell goblin upstream, it ends this branch with EOS
+    return stream.flagElfEnd ? GST_FLOW_EOS : GST_FLOW_OK;
+}
+
+//======================================================================================================================
+/// Goblin appsink pad probe, fast start: set the elf caps from the first caps event, before the first sample
+/// The appsink caps are the sample caps, so the elf can start negotiating while the first frame is still decoded
+GstPadProbeReturn BridgeEngine::onCapsEvent(GstPad *pad, GstPadProbeInfo *info, gpointer userData) {
+    BridgeStream &stream = *(BridgeStream *) userData;
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS)
+        return GST_PAD_PROBE_OK;
+    GstCaps *caps = nullptr;
+    gst_event_parse_caps(event, &caps);
+    gchar *str = gst_caps_to_string(caps);
+    LOG_INFO << stream.prefix << "Caps event : " << str;
+    g_free(str);
+    stream.engine->initElf(stream, caps);
+    // Only the first one, the caps changes go with the samples as usual
+    return GST_PAD_PROBE_REMOVE;
+}
+
+//======================================================================================================================
+void BridgeEngine::addCapsProbe(BridgeStream &stream) {
+    GstPad *pad = gst_element_get_static_pad(stream.goblinSink, "sink");
+    MY_ASSERT(pad != nullptr);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, onCapsEvent, &stream, nullptr);
+    gst_object_unref(pad);
+}
+
+//======================================================================================================================
+/// Elf sink pad probe: the time of the first output buffer, then it goes away
+static GstPadProbeReturn onFirstOutput(GstPad *pad, GstPadProbeInfo *info, gpointer userData) {
+    BridgeStream &stream = *(BridgeStream *) userData;
+    stream.tFirstOutputNs = nowNs();
+    return GST_PAD_PROBE_REMOVE;
+}
+
+//======================================================================================================================
+void BridgeEngine::addFirstOutputProbe(BridgeStream &stream) {
+    // For the auto sinks (bins) this is the ghost pad, buffers go through it all the same
+    GstPad *pad = gst_element_get_static_pad(stream.elfSink, "sink");
+    if (pad == nullptr)
+        return;
+    gst_pad_add_probe(pad, GstPadProbeType(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                      onFirstOutput, &stream, nullptr);
+    gst_object_unref(pad);
+}
+
+//======================================================================================================================
+/// Appsink callback: goblin EOS, pass it on to ELF
+void BridgeEngine::onEos(GstAppSink *sink, gpointer userData) {
+    BridgeStream &stream = *(BridgeStream *) userData;
+    LOG_INFO << stream.prefix << "GOBLIN EOS !";
+    stream.engine->endStream(stream);
+}
+
+//======================================================================================================================
+/// Work pool mode: run the pending appsink events of one stream, in order
+/// At most one drain task per stream exists at a time, so the stream is processed serially, on any pool thread
+void BridgeEngine::drainPool(BridgeStream &stream) {
+    GstAppSink *sink = GST_APP_SINK(stream.goblinSink);
+    for (;;) {
+        // Never wait for need-data on a pool thread: park the stream, need-data submits the drain again
+        if (stream.elfSrc && stream.flagInit && !stream.gate.flagRun) {
+            stream.flagParked = true;
+            // Unless need-data came right now: then either it resubmits, or we go on, not both
+            if (!stream.gate.flagRun || !stream.flagParked.exchange(false))
+                return;
+        }
+
+        // There is one sample in the appsink for each new-sample event, no sample = the EOS event
+        GstSample *sample = gst_app_sink_try_pull_sample(sink, 0);
+        if (sample != nullptr) {
+            dispatchSample(stream, sample);
+        } else if (stream.flagEos) {
+            LOG_INFO << stream.prefix << "GOBLIN EOS !";
+            endStream(stream);
+        }
+        // Only this task decrements: above 1, it cannot drop to 0 here, no lock needed
+        if (stream.countPending > 1) {
+            --stream.countPending;
+            continue;
+        }
+        // The last one under the lock, so that wait() cannot see 0 and destroy the stream before the notify
+        std::lock_guard<std::mutex> lock(stream.mutexPending);
+        if (stream.countPending.fetch_sub(1) == 1) {
+            stream.condPending.notify_all();
+            return;
+        }
+    }
+}
+
+//======================================================================================================================
+void BridgeEngine::submitDrain(BridgeStream &stream) {
+    workPool->submit([this, &stream]{
+        drainPool(stream);
+    });
+}
+
+//======================================================================================================================
+/// Appsink callback in the work pool mode: only schedule the drain task, if the stream does not have one yet
+GstFlowReturn BridgeEngine::onNewSamplePool(GstAppSink *sink, gpointer userData) {
+    BridgeStream &stream = *(BridgeStream *) userData;
+    if (stream.countPending.fetch_add(1) == 0)
+        stream.engine->submitDrain(stream);
+    return stream.flagElfEnd ? GST_FLOW_EOS : GST_FLOW_OK;
+}
+
+//======================================================================================================================
+/// Appsink callback in the work pool mode: EOS goes through the drain task too, after all the samples
+void BridgeEngine::onEosPool(GstAppSink *sink, gpointer userData) {
+    BridgeStream &stream = *(BridgeStream *) userData;
+    stream.flagEos = true;
+    if (stream.countPending.fetch_add(1) == 0)
+        stream.engine->submitDrain(stream);
+}
+
+//======================================================================================================================
+/// Callback called when the pipeline wants more data
+void BridgeEngine::onNeedData(GstElement *source, guint size, gpointer userData) {
+    BridgeStream &stream = *(BridgeStream *) userData;
+    if (feedGateOpen(stream.gate))
+        LOG_DEBUG << stream.prefix << "startFeed !";
+    // Work pool mode: the stream waits for us
+    if (stream.flagParked.exchange(false))
+        stream.engine->submitDrain(stream);
+}
+
+//======================================================================================================================
+/// Callback called when the pipeline wants no more data for now
+void BridgeEngine::onEnoughData(GstElement *source, gpointer userData) {
+    BridgeStream &stream = *(BridgeStream *) userData;
+    if (feedGateClose(stream.gate))
+        LOG_DEBUG << stream.prefix << "stopFeed !";
+}
@@ -0,0 +1,545 @@
+//
+// Created by IT-JIM
+// GSTBRIDGE: The goblin (appsinks) -> processing -> elf (appsrcs) bridge engine, shared by the examples
+// The examples only give the pipelines and the processing callbacks, all the plumbing and tunables live here
+
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <climits>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+
+#include "my_assert.h"
+#include "clock_ns.h"
+#include "latency_trace.h"
+#include "async_log.h"
+#include "work_pool.h"
+#include "frame_record.h"
+#include "spsc_ring.h"
+
+//======================================================================================================================
+/// Check GStreamer error, exit on error
+inline void checkErr(GError *err) {
+    if (err) {
+        std::cerr << "checkErr : " << err->message << std::endl;
+        exit(0);
+    }
+}
+
+//======================================================================================================================
+/// Appsrc feed gate: need-data opens it, enough-data closes it, the producer thread waits on it
+/// The condition variable wakes the producer right away, instead of polling a flag every 10 ms
+struct FeedGate {
+    /// When it's true, send the data, otherwise wait
+    std::atomic_bool flagRun{false};
+    std::mutex mutex;
+    std::condition_variable cond;
+    /// Wait with the old 10 ms sleep loop instead of the condition variable (for comparison)
+    bool poll = false;
+
+    /// Stall statistics, updated by the producer thread only
+    int countStalls = 0;
+    int64_t stallNs = 0;
+    /// Time from need-data to the producer running again
+    int64_t wakeNs = 0;
+    /// When the gate was last opened
+    std::atomic<int64_t> openTimeNs{0};
+};
+
+/// Open the gate and wake up the producer, return false if it was already open
+bool feedGateOpen(FeedGate &gate);
+
+/// Close the gate, return false if it was already closed
+bool feedGateClose(FeedGate &gate);
+
+/// Block the producer until the gate is open, and measure the stall
+void feedGateWait(FeedGate &gate, const std::string &prefix);
+
+/// Print the stall statistics of a gate
+void feedGatePrintStats(const FeedGate &gate, const std::string &prefix);
+
+//======================================================================================================================
+/// Process a single bus message, log messages, exit on error, return false on eof
+bool busProcessMsg(GstElement *pipeline, GstMessage *msg, const std::string &prefix);
+
+//======================================================================================================================
+/// Bus dispatcher: watches the buses of many pipelines from a single thread
+/// A sync handler on each bus moves the messages into one queue, instead of one thread per bus blocked in
+/// gst_bus_timed_pop(), so the bus thread count stays at one however many pipelines (streams) we run
+class BusDispatcher {
+public:
+    /// Message handler of one pipeline, returns false on EOS (then the pipeline is done)
+    typedef std::function<bool(GstElement *pipeline, GstMessage *msg)> Handler;
+
+    ~BusDispatcher();
+
+    /// Watch the bus of a pipeline, before it starts playing; no handler = busProcessMsg() with the prefix
+    /// Can be called while the dispatcher is running
+    void add(GstElement *pipeline, const std::string &prefix, Handler handler = nullptr);
+
+    /// Stop watching a pipeline, its remaining messages are dropped; call it after the pipeline is stopped
+    void remove(GstElement *pipeline);
+
+    /// Start the dispatcher thread, if not yet running
+    void start();
+
+    /// Block until the handler of the pipeline has seen EOS
+    void waitDone(GstElement *pipeline);
+
+    /// Stop and join the dispatcher thread, the messages still in the queue are dropped
+    void stop();
+
+    /// Statistics: messages dispatched, max queue depth
+    int64_t countMessages = 0;
+    size_t maxQueueDepth = 0;
+
+private:
+    /// One watched pipeline
+    struct Watch {
+        BusDispatcher *dispatcher = nullptr;
+        GstElement *pipeline = nullptr;
+        GstBus *bus = nullptr;
+        std::string prefix;
+        Handler handler;
+        /// The handler has seen EOS
+        bool flagDone = false;
+    };
+
+    static GstBusSyncReply onSyncMessage(GstBus *bus, GstMessage *msg, gpointer userData);
+    void post(Watch *watch, GstMessage *msg);
+    void codeThreadDispatch();
+
+    /// Protects everything below
+    std::mutex mutex;
+    /// The dispatcher thread waits here for the messages
+    std::condition_variable condMsg;
+    /// waitDone() waits here
+    std::condition_variable condDone;
+    std::vector<std::unique_ptr<Watch>> watches;
+    /// Messages from all buses, in the order they were posted, each holds a reference
+    std::deque<std::pair<Watch *, GstMessage *>> queue;
+    /// The watch whose handler is running now
+    Watch *busyWatch = nullptr;
+    bool flagStop = false;
+    std::thread thread;
+};
+
+//======================================================================================================================
+/// Create and activate a buffer pool for the elf output buffers
+/// All maxBuffers buffers of bufferSize bytes are allocated right away, then simply recycled
+GstBufferPool *createElfPool(GstCaps *caps, guint bufferSize, guint maxBuffers);
+
+/// Get an output buffer of bufferSize bytes from the pool (hit)
+/// If there is no pool, the pool is exhausted or its buffers are too small, allocate a new buffer (miss)
+GstBuffer *acquireElfBuffer(GstBufferPool *pool, gsize bufferSize, std::atomic_int &hits, std::atomic_int &misses);
+
+/// Deactivate and destroy the pool, if any
+void destroyElfPool(GstBufferPool *&pool);
+
+//======================================================================================================================
+/// Tunables of one stream, mostly from the command line, see parseBridgeOption()
+struct BridgeOptions {
+    /// Wait for need-data by polling every 10 ms (old behavior, for comparison)
+    bool poll = false;
+    /// Process samples in appsink callbacks on the goblin streaming thread, instead of a processing thread
+    bool useCallbacks = false;
+    /// Number of parallel processing workers, 0 = process in the appsink thread (or callback)
+    int numWorkers = 0;
+    /// Limit on frames in the parallel stage, 0 = 2 per worker
+    size_t maxInFlight = 0;
+    /// Batch mode: pull up to batchSize samples, wait at most batchWaitMs for a full batch, 0 = no batches
+    int batchSize = 0;
+    int batchWaitMs = 10;
+    /// Batch mode: push each batch to ELF as one GstBufferList
+    bool useBufferList = false;
+    /// Size of the elf output buffer pool, 0 = allocate a new buffer for each copy
+    int poolSize = 0;
+    /// Goblin appsink max-buffers, 0 = as in the pipeline description
+    int maxBuffers = 0;
+    /// Elf appsrc max-bytes, 0 = as in the pipeline description (appsrc default is 200000)
+    guint64 maxBytes = 0;
+    /// Per-buffer latency tracing, print the histograms every tracePeriodMs (0 = only at the end)
+    bool trace = false;
+    int tracePeriodMs = 0;
+    /// Goblin queue: a thread of its own pulls the appsink into a ring of queueDepth samples, 0 = no queue
+    /// When the ring is full, block (backpressure to the demuxer) or drop the new sample (queueDrop)
+    int queueDepth = 0;
+    bool queueDrop = false;
+    /// Fast start: bring elf up to PAUSED while goblin starts, and set the elf caps from the first caps event
+    /// of the goblin appsink instead of the first sample; elf pre-rolls if any stream has it
+    bool fastStart = false;
+    /// A/V interleaving (see BridgeEngine::interleaveSkewNs): another stream which has not pushed for this long
+    /// does not hold this one back any more, so a stuck or starved stream stalls the others for at most that
+    int interleaveStallMs = 200;
+};
+
+/// Parse a whole decimal number in [minValue, maxValue] from the command line, without exceptions
+/// Return false (and leave value alone) if it's not one, the caller reports "Bad value for <option>"
+bool parseIntArg(const std::string &s, long long &value, long long minValue, long long maxValue);
+bool parseIntArg(const std::string &s, int &value, int minValue = 0, int maxValue = INT_MAX);
+
+/// Parse the goblin queue spec "<depth>[:drop|:block]" into the options, return false if it's bad
+bool parseQueueSpec(BridgeOptions &opts, const std::string &spec);
+
+/// Parse one common option at argv[i] (and its value), return false if it is not ours
+bool parseBridgeOption(BridgeOptions &opts, int &i, int argc, char **argv);
+
+/// Print the usage of the common options
+void printBridgeUsage();
+
+//======================================================================================================================
+/// Goblin appsink caps for video processing
+/// Native: the decoder's I420 or NV12 passes videoconvert untouched (passthrough), anything else is converted to BGR
+/// bgr = true : always BGR, which costs two colorspace conversions per frame (goblin to BGR, elf back to YUV)
+const char *bridgeVideoCaps(bool bgr);
+
+/// Transcode-to-file mode: the elf branch after the appsrc, which encodes to a file instead of playing
+/// The encoder is chosen by the file extension, the encoder gets name=elfSinkName (it's where our buffers end),
+/// the filesink has sync=false so that the whole chain runs as fast as possible
+/// Video : .y4m = raw video, .mkv = H.264 in Matroska, anything else = H.264 in MP4
+/// Audio : .wav = raw PCM, anything else = Vorbis in Ogg
+std::string elfFileBranchVideo(const std::string &fileName, const std::string &elfSinkName);
+std::string elfFileBranchAudio(const std::string &fileName, const std::string &elfSinkName);
+
+/// Number of colorspace converters in the pipeline which actually convert, i.e. are not in passthrough
+/// This is the number of conversions per frame, meaningful only when the caps are negotiated
+int countActiveConversions(GstElement *pipeline);
+
+//======================================================================================================================
+/// One buffer in the parallel processing stage
+struct FrameJob {
+    /// Sequence number in the appsink order, which is the PTS order for decoded streams
+    uint64_t seq = 0;
+    /// Input sample, owned by the job until processed
+    GstSample *sample = nullptr;
+    /// Processed output buffer
+    GstBuffer *buffer = nullptr;
+    /// When the processing finished, for the reorder latency
+    int64_t tDoneNs = 0;
+};
+
+//======================================================================================================================
+/// Parallel processing stage: N workers between the goblin appsink and the elf appsrc
+/// Frames are processed in any order, and pushed to ELF in the PTS order via a bounded reorder buffer
+struct WorkerStage {
+    std::vector<std::thread> workers;
+    /// Protects everything below
+    std::mutex mutex;
+    /// Workers wait here for the new jobs
+    std::condition_variable condJob;
+    /// The producer waits here while too many frames are in flight
+    std::condition_variable condSpace;
+    /// Frames waiting for a worker
+    std::deque<FrameJob> queue;
+    /// Finished frames waiting for their turn, by sequence number
+    std::map<uint64_t, FrameJob> reorder;
+    /// Limit on frames in flight (queued + processing + reorder buffer), bounds both queues
+    size_t maxInFlight = 0;
+    /// Next sequence number to submit, next sequence number to push to ELF
+    uint64_t seqIn = 0;
+    uint64_t seqOut = 0;
+    /// No more frames are coming
+    bool flagStop = false;
+    /// A worker is pushing the frames which are next in order, the others only leave theirs in the reorder buffer
+    bool flagPushing = false;
+
+    // Statistics
+    size_t maxQueueDepth = 0;
+    uint64_t sumQueueDepth = 0;
+    size_t maxReorderDepth = 0;
+    int64_t sumReorderNs = 0;
+    int64_t maxReorderNs = 0;
+};
+
+//======================================================================================================================
+/// A/V interleaving state and statistics of one stream, see BridgeEngine::interleaveSkewNs
+/// Protected by the interleaving mutex of the engine
+struct InterleaveState {
+    /// PTS of the buffer the stream is about to push, or of the last one it pushed
+    /// -1 = nothing yet, or the stream has ended; then it does not hold the other streams back
+    int64_t pts = -1;
+    /// When pts was last updated: a stream which has not moved for a while does not hold the others back either
+    int64_t tUpdateNs = 0;
+    /// The elf queue right after the appsrc (if any), its level is sampled at each push
+    GstElement *elfQueue = nullptr;
+
+    // Statistics
+    int64_t countPushes = 0;
+    int countWaits = 0;
+    int64_t waitNs = 0;
+    /// Pushes let through past a stalled stream
+    int countStallSkips = 0;
+    /// PTS ahead of the slowest other stream at push time
+    int64_t sumSkewNs = 0;
+    int64_t maxSkewNs = 0;
+    /// Elf queue level (time) at push time
+    uint64_t sumQueueNs = 0;
+    uint64_t maxQueueNs = 0;
+};
+
+class BridgeEngine;
+
+//======================================================================================================================
+/// One stream through the bridge: goblin appsink -> processing -> elf appsrc
+/// Either end can be missing: no elf appsrc = the processing consumes the samples (video1),
+/// no goblin appsink = the source callback produces the buffers (video2)
+struct BridgeStream {
+    BridgeEngine *engine = nullptr;
+    /// Log prefix, e.g. "V : "
+    std::string prefix;
+    BridgeOptions opts;
+
+    GstElement *goblinSink = nullptr;
+    GstElement *elfSrc = nullptr;
+    /// The elf sink, its sink pad is the last point of the latency trace
+    GstElement *elfSink = nullptr;
+
+    /// Processing callback: takes ownership of the sample, returns the buffer for the elf appsrc (nullptr = none)
+    /// Must be thread-safe with workers. No callback = passthrough
+    std::function<GstBuffer *(BridgeStream &stream, GstSample *sample)> process;
+    /// Batch processing callback: takes ownership of the samples, puts the output buffers into buffersOut
+    /// No callback = process() for each sample
+    std::function<void(BridgeStream &stream, std::vector<GstSample *> &samples,
+                       std::vector<GstBuffer *> &buffersOut)> processBatch;
+    /// Called with the first sample, and again whenever the caps change, before the elf caps are set,
+    /// e.g. to read the format; caps and videoInfo are already updated
+    std::function<void(BridgeStream &stream, GstSample *sample)> init;
+    /// Producer for a stream without a goblin appsink, sends the buffers with BridgeEngine::push()
+    /// or the samples (to be processed as if they came from goblin) with BridgeEngine::feed()
+    std::function<void(BridgeStream &stream)> source;
+    /// If set, every goblin sample is written here as it is pulled, in the stream order (see frame_record.h)
+    FrameRecorder *recorder = nullptr;
+
+    /// Forward the goblin buffers to elf by reference, even if there is a process callback
+    bool passthrough = false;
+    /// Output pool buffer size = first buffer size * poolMargin, audio buffers vary in size
+    double poolMargin = 1;
+
+    /// Appsrc gate: when it's open, send the data, otherwise wait
+    FeedGate gate;
+    /// True when the elf caps are set from the first sample
+    std::atomic_bool flagInit{false};
+    /// Caps of the last goblin sample (our own reference), parsed into videoInfo only when they change
+    /// Processing callbacks use videoInfo instead of parsing the caps of every sample
+    GstCaps *caps = nullptr;
+    bool isVideo = false;
+    GstVideoInfo videoInfo;
+    /// Mid-stream caps changes (e.g. resolution), each one re-negotiates ELF and re-creates the pool
+    int countCapsChanges = 0;
+    /// Buffer pool for the elf output buffers, created when elf caps are set
+    GstBufferPool *pool = nullptr;
+    /// Output buffer statistics: forwarded by reference, copied in make_writable(), taken from the pool or allocated
+    std::atomic_int countForwarded{0};
+    std::atomic_int countWritableCopies{0};
+    std::atomic_int poolHits{0};
+    std::atomic_int poolMisses{0};
+
+    /// The parallel processing stage
+    WorkerStage stage;
+    /// Batch statistics, updated by the processing thread only
+    int countBatches = 0;
+    int countBatchFrames = 0;
+
+    /// Goblin queue between the appsink and the processing thread, created by start() if opts.queueDepth > 0
+    /// The processing of one stream can fall behind without blocking the shared demuxer (and the other streams)
+    std::unique_ptr<SpscRing<GstSample *>> goblinQueue;
+    /// Queue statistics: samples pulled and dropped, ring occupancy at each pull, how many times and how long
+    /// the queue thread was blocked by a full ring, i.e. the shared demuxer was stalled by this stream (all written
+    /// by the queue thread), time the processing thread waited on an empty ring
+    int64_t countQueued = 0;
+    int64_t countQueueDropped = 0;
+    uint64_t sumQueueOccupancy = 0;
+    size_t maxQueueOccupancy = 0;
+    int64_t countQueueBlocked = 0;
+    int64_t queueBlockNs = 0;
+    int64_t queueBlockMaxNs = 0;
+    int64_t queueWaitNs = 0;
+
+    /// Per-buffer latency tracing from the goblin appsink pull to the elf sink
+    LatencyTrace trace;
+
+    /// A/V interleaving of the elf pushes
+    InterleaveState interleave;
+
+    /// Startup (time to first frame): when the elf caps were set, the first goblin sample came,
+    /// and the first buffer reached the elf sink, nowNs(), 0 = not yet
+    int64_t tInitNs = 0;
+    int64_t tFirstSampleNs = 0;
+    std::atomic<int64_t> tFirstOutputNs{0};
+
+    /// Throughput: buffers and bytes pushed to ELF, from BridgeEngine::start() to the end of the stream
+    std::atomic<int64_t> countPushed{0};
+    std::atomic<int64_t> bytesPushed{0};
+    int64_t tStartNs = 0;
+    std::atomic<int64_t> tEndNs{0};
+    /// Stream time pushed to ELF: the PTS of the first buffer and the end (PTS + duration) of the last one,
+    /// for the speed relative to realtime; written by the pushing thread only
+    int64_t mediaStartNs = -1;
+    std::atomic<int64_t> mediaEndNs{0};
+
+    /// Work pool mode: appsink events (samples + EOS) not yet handled by the drain task
+    std::atomic_int countPending{0};
+    /// Work pool mode: the drain task notifies when countPending drops to 0, BridgeEngine::wait() waits for it
+    std::mutex mutexPending;
+    std::condition_variable condPending;
+    /// Work pool mode: the drain task stopped on a closed gate, need-data must submit it again
+    std::atomic_bool flagParked{false};
+    std::atomic_bool flagEos{false};
+    /// The elf appsrc has refused a buffer (flushing or EOS): nothing more is processed or pushed
+    std::atomic_bool flagElfEnd{false};
+};
+
+//======================================================================================================================
+/// Helpers for the processing callbacks, all take ownership of the sample
+
+/// Passthrough: the goblin buffer itself, all timestamps, flags and metas stay
+GstBuffer *forwardBuffer(GstSample *sample);
+
+/// In-place: the goblin buffer, writable; normally we are the only owner, and make_writable() does not copy anything
+/// The goblin appsink needs enable-last-sample=false for that
+GstBuffer *writableBuffer(BridgeStream &stream, GstSample *sample);
+
+/// Copy: a new buffer from the stream pool with a copy of the data, PTS, duration and metas
+GstBuffer *copyBuffer(BridgeStream &stream, GstSample *sample);
+
+//======================================================================================================================
+/// The video processing of the examples: photo negative of the middle 1/9 of the frame, in all planes
+/// Works on the decoder's native I420 or NV12 just as well as on BGR, so no colorspace conversion is needed
+void processFrameInvertRoi(GstVideoFrame &frame);
+
+/// Process one video sample with processFrameInvertRoi(), in the goblin buffer (inPlace) or in a pool copy
+/// Takes ownership of the sample, thread-safe (can run in several workers at once)
+/// A buffer that does not match the stream caps is passed on untouched
+GstBuffer *processBufferInvertRoi(BridgeStream &stream, GstSample *sample, bool inPlace);
+
+/// The batch version of processBufferInvertRoi(), for BridgeStream::processBatch: maps all frames of the batch,
+/// processes them in one pass, then unmaps them; takes ownership of the samples
+void processBatchInvertRoi(BridgeStream &stream, std::vector<GstSample *> &samples,
+                           std::vector<GstBuffer *> &buffersOut, bool inPlace);
+
+//======================================================================================================================
+/// The bridge engine: owns the goblin and elf pipelines, the bus threads and the processing threads of all streams
+/// ELF starts when all of its streams have their caps from the first samples
+class BridgeEngine {
+public:
+    /// Create the pipelines from the descriptions, either can be empty
+    BridgeEngine(const std::string &goblinDesc, const std::string &elfDesc);
+
+    ~BridgeEngine();
+
+    /// Add a stream by the element names (empty = none), the options come from the command line
+    BridgeStream &addStream(const BridgeOptions &opts, const std::string &goblinSinkName,
+                            const std::string &elfSrcName, const std::string &elfSinkName,
+                            const std::string &prefix = "");
+
+    /// Play, run all streams until EOS on all pipelines, same as start() + wait()
+    void run();
+
+    /// Play and start processing, don't wait
+    void start();
+
+    /// Wait for EOS on all pipelines, then stop them
+    void wait();
+
+    /// Print the statistics of all streams
+    void printStats();
+
+    /// Set the elf caps of a stream, and start ELF when all streams are ready
+    void initElf(BridgeStream &stream, GstCaps *caps);
+
+    /// Source streams: wait for need-data, then push one buffer (takes ownership)
+    void waitFeed(BridgeStream &stream);
+    void push(BridgeStream &stream, GstBuffer *buffer);
+    /// Source streams: process one sample like a goblin sample (caps, workers, process callback), then push it
+    /// Takes ownership of the sample
+    void feed(BridgeStream &stream, GstSample *sample);
+
+    GstElement *goblinPipeline = nullptr;
+    GstElement *elfPipeline = nullptr;
+
+    /// Bus dispatcher shared by many engines, nullptr = run() uses one of its own
+    BusDispatcher *busDispatcher = nullptr;
+    /// Prefix of the bus log, to tell the engines apart
+    std::string busPrefix;
+    /// Work pool shared by many engines: process the samples of all goblin streams as pool tasks, no threads
+    /// of our own; nullptr = a processing thread per stream (or appsink callbacks)
+    WorkPool *workPool = nullptr;
+    /// Colorspace conversions per frame in each pipeline, counted at EOS
+    int conversionsGoblin = 0;
+    int conversionsElf = 0;
+    /// A/V interleaving, 0 = off: a stream pushes a buffer to elf only if its PTS is at most interleaveSkewNs ahead
+    /// of all the other streams, so the elf streams go in the timestamp order and no elf queue fills up with
+    /// the stream which happens to run ahead; set before start(); not with workPool, whose tasks must not wait
+    int64_t interleaveSkewNs = 0;
+
+private:
+    void startElf();
+    void prerollElf();
+    void initStream(BridgeStream &stream, GstSample *sample);
+    GstBuffer *processBuffer(BridgeStream &stream, GstSample *sample);
+    void processSample(BridgeStream &stream, GstSample *sample);
+    void processBatch(BridgeStream &stream, std::vector<GstSample *> &samples, std::vector<GstBuffer *> &buffersOut);
+    void pushBatch(BridgeStream &stream, std::vector<GstBuffer *> &buffers);
+    void endElfFlow(BridgeStream &stream, GstFlowReturn ret);
+    void dispatchSample(BridgeStream &stream, GstSample *sample);
+    void endStream(BridgeStream &stream);
+    void interleaveWait(BridgeStream &stream, GstBuffer *buffer);
+    void interleaveEnd(BridgeStream &stream);
+    void interleaveUpdate(BridgeStream &stream, int64_t pts);
+    int64_t interleaveTry(BridgeStream &stream, int64_t pts, bool flagWaited);
+
+
+    void codeThreadQueue(BridgeStream &stream);
+    void codeThreadProcess(BridgeStream &stream);
+    void codeThreadBatch(BridgeStream &stream);
+    void codeThreadWorker(BridgeStream &stream);
+    void startWorkers(BridgeStream &stream);
+    void submitSample(BridgeStream &stream, GstSample *sample);
+    void stopWorkers(BridgeStream &stream);
+    void drainWorkers(BridgeStream &stream);
+
+    void drainPool(BridgeStream &stream);
+    void submitDrain(BridgeStream &stream);
+
+    static GstFlowReturn onNewSample(GstAppSink *sink, gpointer userData);
+    static void onEos(GstAppSink *sink, gpointer userData);
+    static GstFlowReturn onNewSamplePool(GstAppSink *sink, gpointer userData);
+    static void onEosPool(GstAppSink *sink, gpointer userData);
+    static void onNeedData(GstElement *source, guint size, gpointer userData);
+    static GstPadProbeReturn onCapsEvent(GstPad *pad, GstPadProbeInfo *info, gpointer userData);
+    void addCapsProbe(BridgeStream &stream);
+    void addFirstOutputProbe(BridgeStream &stream);
+    static void onEnoughData(GstElement *source, gpointer userData);
+
+    /// BridgeStream has mutexes and atomics and cannot be moved, so we keep pointers
+    std::vector<std::unique_ptr<BridgeStream>> streams;
+    /// Protects the interleaving state of all streams, the pushing threads wait for each other here
+    std::mutex mutexInterleave;
+    std::condition_variable condInterleave;
+    /// Protects starting of ELF
+    std::mutex mutexElfStart;
+    std::atomic_bool flagElfStarted{false};
+    /// Startup timing: start(), and when ELF was set to PLAYING, nowNs()
+    int64_t tStartNs = 0;
+    int64_t tElfPlayNs = 0;
+
+    /// Processing (or source) threads and the bus dispatcher, between start() and wait()
+    std::vector<std::thread> threads;
+    std::unique_ptr<BusDispatcher> ownBus;
+    BusDispatcher *bus = nullptr;
+};
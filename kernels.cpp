@@ -0,0 +1,169 @@
+//
+// Created by IT-JIM
+// KERNELS: SIMD per-pixel kernels with runtime CPU dispatch, shared by the examples
+
+#include <cstring>
+#include <atomic>
+
+#include "kernels.h"
+
+// SIMD variants are compiled with target attributes, so no special compiler flags are needed
+// The dispatcher never calls a variant which the CPU does not support
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+//======================================================================================================================
+const char *simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::SSE2:
+            return "SSE2";
+        case SimdLevel::AVX2:
+            return "AVX2";
+        case SimdLevel::AVX512:
+            return "AVX512";
+        default:
+            return "SCALAR";
+    }
+}
+
+//======================================================================================================================
+SimdLevel simdDetectLevel() {
+    static const SimdLevel detected = [] {
+#ifdef KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+            return SimdLevel::AVX512;
+        if (__builtin_cpu_supports("avx2"))
+            return SimdLevel::AVX2;
+        if (__builtin_cpu_supports("sse2"))
+            return SimdLevel::SSE2;
+#endif
+        return SimdLevel::SCALAR;
+    }();
+    return detected;
+}
+
+//======================================================================================================================
+/// Level cap set by simdSetLevel(), -1 = no cap
+static std::atomic_int simdCap{-1};
+
+SimdLevel simdLevel() {
+    int detected = (int) simdDetectLevel();
+    int cap = simdCap;
+    return SimdLevel((cap >= 0 && cap < detected) ? cap : detected);
+}
+
+void simdSetLevel(SimdLevel level) {
+    simdCap = (int) level;
+}
+
+//======================================================================================================================
+// kernelInvert() variants, each one inverts a single row, the tail is always done by the scalar code
+//======================================================================================================================
+static void invertRowScalar(uint8_t *p, size_t n) {
+    // 8 bytes at a time, memcpy avoids unaligned access problems and compiles into a plain load/store
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t v;
+        memcpy(&v, p + i, 8);
+        v = ~v;
+        memcpy(p + i, &v, 8);
+    }
+    for (; i < n; ++i)
+        p[i] = ~p[i];
+}
+
+#ifdef KERNELS_X86
+//======================================================================================================================
+__attribute__((target("sse2")))
+static void invertRowSse2(uint8_t *p, size_t n) {
+    const __m128i ones = _mm_set1_epi8(-1);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+        _mm_storeu_si128((__m128i *) (p + i), _mm_xor_si128(v, ones));
+    }
+    invertRowScalar(p + i, n - i);
+}
+
+//======================================================================================================================
+__attribute__((target("avx2")))
+static void invertRowAvx2(uint8_t *p, size_t n) {
+    const __m256i ones = _mm256_set1_epi8(-1);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *) (p + i));
+        __m256i v1 = _mm256_loadu_si256((const __m256i *) (p + i + 32));
+        _mm256_storeu_si256((__m256i *) (p + i), _mm256_xor_si256(v0, ones));
+        _mm256_storeu_si256((__m256i *) (p + i + 32), _mm256_xor_si256(v1, ones));
+    }
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+        _mm256_storeu_si256((__m256i *) (p + i), _mm256_xor_si256(v, ones));
+    }
+    invertRowScalar(p + i, n - i);
+}
+
+//======================================================================================================================
+__attribute__((target("avx512f,avx512bw")))
+static void invertRowAvx512(uint8_t *p, size_t n) {
+    const __m512i ones = _mm512_set1_epi8(-1);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void *) (p + i));
+        _mm512_storeu_si512((void *) (p + i), _mm512_xor_si512(v, ones));
+    }
+    // Masked load/store for the tail, no scalar loop needed
+    if (i < n) {
+        __mmask64 mask = (~__mmask64(0)) >> (64 - (n - i));
+        __m512i v = _mm512_maskz_loadu_epi8(mask, (const void *) (p + i));
+        _mm512_mask_storeu_epi8((void *) (p + i), mask, _mm512_xor_si512(v, ones));
+    }
+}
+#endif
+
+//======================================================================================================================
+typedef void (*InvertRowFn)(uint8_t *, size_t);
+
+static const KernelTable<InvertRowFn> &invertTable() {
+    static const KernelTable<InvertRowFn> table = [] {
+        KernelTable<InvertRowFn> t;
+        t.impl[(int) SimdLevel::SCALAR] = invertRowScalar;
+#ifdef KERNELS_X86
+        t.impl[(int) SimdLevel::SSE2] = invertRowSse2;
+        t.impl[(int) SimdLevel::AVX2] = invertRowAvx2;
+        t.impl[(int) SimdLevel::AVX512] = invertRowAvx512;
+#endif
+        return t;
+    }();
+    return table;
+}
+
+//======================================================================================================================
+void kernelInvert(SimdLevel level, uint8_t *data, size_t rowBytes, int rows, size_t stride) {
+    InvertRowFn fn = invertTable().select(level);
+    for (int y = 0; y < rows; ++y)
+        fn(data + y * stride, rowBytes);
+}
+
+//======================================================================================================================
+void kernelInvert(uint8_t *data, size_t rowBytes, int rows, size_t stride) {
+    kernelInvert(simdLevel(), data, rowBytes, rows, stride);
+}
+
+//======================================================================================================================
+void kernelInvertRect(const KernelPlane *planes, int numPlanes, int x, int y, int w, int h) {
+    InvertRowFn fn = invertTable().select();
+    for (int p = 0; p < numPlanes; ++p) {
+        const KernelPlane &plane = planes[p];
+        // Chroma rectangle: both ends are scaled, so that odd x or w do not lose a column
+        int x0 = x >> plane.shiftW, x1 = (x + w) >> plane.shiftW;
+        int y0 = y >> plane.shiftH, y1 = (y + h) >> plane.shiftH;
+        size_t rowBytes = size_t(x1 - x0) * plane.pixelStride;
+        uint8_t *data = plane.data + y0 * plane.stride + size_t(x0) * plane.pixelStride;
+        for (int row = y0; row < y1; ++row, data += plane.stride)
+            fn(data, rowBytes);
+    }
+}
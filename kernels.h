@@ -0,0 +1,68 @@
+//
+// Created by IT-JIM
+// KERNELS: SIMD per-pixel kernels with runtime CPU dispatch, shared by the examples
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+//======================================================================================================================
+/// Instruction set levels, from the worst to the best
+enum class SimdLevel {
+    SCALAR = 0,
+    SSE2 = 1,
+    AVX2 = 2,
+    AVX512 = 3,
+};
+
+/// Human-readable name of a level
+const char *simdLevelName(SimdLevel level);
+
+/// The best level supported by this CPU (checked with cpuid once)
+SimdLevel simdDetectLevel();
+
+/// The level the kernels actually use: detected level, unless capped with simdSetLevel()
+SimdLevel simdLevel();
+
+/// Cap the level used by kernels (for benchmarks), it is still never higher than the detected level
+void simdSetLevel(SimdLevel level);
+
+//======================================================================================================================
+/// A table of implementations of one kernel, one per level (nullptr = not implemented)
+/// select() returns the best implementation not above the current level, scalar must always exist
+/// Any new per-pixel kernel can reuse the dispatch: write the variants, fill a table, call select()
+template<typename Fn>
+struct KernelTable {
+    Fn impl[4] = {nullptr, nullptr, nullptr, nullptr};
+
+    Fn select(SimdLevel level = simdLevel()) const {
+        for (int i = (int) level; i > 0; --i)
+            if (impl[i] != nullptr)
+                return impl[i];
+        return impl[0];
+    }
+};
+
+//======================================================================================================================
+/// Invert (bitwise NOT) a 2D block of bytes in-place: rows of rowBytes bytes, stride bytes apart
+/// Works for any packed pixel format, e.g. for BGR the row is 3 * width bytes
+void kernelInvert(uint8_t *data, size_t rowBytes, int rows, size_t stride);
+
+/// Same as kernelInvert(), with an explicitly chosen level (must be supported by this CPU)
+void kernelInvert(SimdLevel level, uint8_t *data, size_t rowBytes, int rows, size_t stride);
+
+//======================================================================================================================
+/// One plane of an image, for the kernels which work on packed and planar formats alike
+struct KernelPlane {
+    uint8_t *data = nullptr;
+    size_t stride = 0;
+    /// Bytes per pixel in this plane: 3 for BGR, 1 for I420 Y, U, V and NV12 Y, 2 for NV12 UV
+    int pixelStride = 1;
+    /// Subsampling as a shift of the coordinates: 1, 1 for I420 U, V and NV12 UV, 0, 0 for full resolution planes
+    int shiftW = 0, shiftH = 0;
+};
+
+/// Invert a rectangle of an image in all of its planes, in-place
+/// x, y, w, h are in full resolution pixels, they are scaled down for the subsampled planes
+void kernelInvertRect(const KernelPlane *planes, int numPlanes, int x, int y, int w, int h);
@@ -0,0 +1,163 @@
+//
+// Created by IT-JIM
+// LATENCY_TRACE: Per-buffer latency tracing through the bridge, keyed by PTS, with fixed log-scale histograms
+
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+#include "clock_ns.h"
+#include "latency_trace.h"
+
+//======================================================================================================================
+void LatencyHistogram::add(int64_t ns) {
+    ++countValues;
+    sumNs += ns;
+    maxNs = std::max(maxNs, ns);
+    // Bucket 0 is below 1 us, then the power of 2 and SUB_BITS bits below the leading one
+    uint64_t us = ns > 0 ? uint64_t(ns) / 1000 : 0;
+    int idx = 0;
+    if (us > 0) {
+        int e = 63 - __builtin_clzll(us);
+        int sub = int((e >= SUB_BITS ? us >> (e - SUB_BITS) : us << (SUB_BITS - e)) & ((1 << SUB_BITS) - 1));
+        idx = std::min(1 + (e << SUB_BITS) + sub, NUM_BUCKETS - 1);
+    }
+    ++buckets[idx];
+}
+
+//======================================================================================================================
+double LatencyHistogram::percentileUs(double p) const {
+    if (countValues == 0)
+        return 0;
+    int64_t target = std::max(int64_t(1), int64_t(p * countValues + 0.5));
+    int64_t sum = 0;
+    for (int idx = 0; idx < NUM_BUCKETS; ++idx) {
+        sum += buckets[idx];
+        if (sum >= target) {
+            double upperUs = 1;
+            if (idx > 0) {
+                int e = (idx - 1) >> SUB_BITS;
+                int sub = (idx - 1) & ((1 << SUB_BITS) - 1);
+                upperUs = std::ldexp(double((1 << SUB_BITS) + sub + 1), e - SUB_BITS);
+            }
+            return std::min(upperUs, maxUs());
+        }
+    }
+    return maxUs();
+}
+
+//======================================================================================================================
+LatencyTrace::~LatencyTrace() {
+    stopPeriodic();
+}
+
+//======================================================================================================================
+void LatencyTrace::markNow(TracePoint point, GstClockTime pts) {
+    int64_t t = nowNs();
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (point == TracePoint::PULL) {
+        // A new buffer takes the oldest slot, if that one is still in use, its buffer got lost on the way
+        Slot &slot = slots[head];
+        head = (head + 1) % NUM_SLOTS;
+        if (slot.pts != GST_CLOCK_TIME_NONE)
+            ++countLost;
+        slot.pts = pts;
+        std::fill(slot.tNs, slot.tNs + NUM_POINTS, 0);
+        slot.tNs[(int) TracePoint::PULL] = t;
+        return;
+    }
+
+    // Find the buffer, newest first: it is normally one of the last few
+    for (int i = 1; i <= NUM_SLOTS; ++i) {
+        Slot &slot = slots[(head - i + NUM_SLOTS) % NUM_SLOTS];
+        if (slot.pts != pts)
+            continue;
+        slot.tNs[(int) point] = t;
+        if (point == TracePoint::SINK) {
+            // The buffer is out, add all stages which have both ends marked, and free the slot
+            for (int s = 0; s + 1 < NUM_POINTS; ++s)
+                if (slot.tNs[s] != 0 && slot.tNs[s + 1] != 0)
+                    stages[s].add(slot.tNs[s + 1] - slot.tNs[s]);
+            stages[NUM_STAGES - 1].add(t - slot.tNs[(int) TracePoint::PULL]);
+            slot.pts = GST_CLOCK_TIME_NONE;
+        }
+        return;
+    }
+}
+
+//======================================================================================================================
+/// Pad probe on the elf sink pad
+static GstPadProbeReturn onTraceSinkBuffer(GstPad *pad, GstPadProbeInfo *info, gpointer userData) {
+    LatencyTrace &trace = *(LatencyTrace *) userData;
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+        trace.mark(TracePoint::SINK, GST_PAD_PROBE_INFO_BUFFER(info));
+    } else if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        for (guint i = 0; i < gst_buffer_list_length(list); ++i)
+            trace.mark(TracePoint::SINK, gst_buffer_list_get(list, i));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+void LatencyTrace::attachSink(GstElement *sink) {
+    // For the auto sinks (bins) this is the ghost pad, buffers go through it all the same
+    GstPad *pad = gst_element_get_static_pad(sink, "sink");
+    if (pad == nullptr)
+        return;
+    gst_pad_add_probe(pad, GstPadProbeType(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                      onTraceSinkBuffer, this, nullptr);
+    gst_object_unref(pad);
+}
+
+//======================================================================================================================
+void LatencyTrace::print(std::ostream &out, const std::string &prefix) {
+    static const char *stageNames[NUM_STAGES] = {"pull -> process", "process", "process -> push", "push -> sink",
+                                                  "total"};
+    // Copy under the mutex, print without it
+    LatencyHistogram copy[NUM_STAGES];
+    int64_t lost;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::copy(stages, stages + NUM_STAGES, copy);
+        lost = countLost;
+    }
+    out << prefix << "Latency trace : buffers = " << copy[NUM_STAGES - 1].count() << ", lost = " << lost << std::endl;
+    for (int s = 0; s < NUM_STAGES; ++s) {
+        const LatencyHistogram &h = copy[s];
+        if (h.count() == 0)
+            continue;
+        out << prefix << "  " << stageNames[s] << " : p50 = " << h.percentileUs(0.5) << " us, p95 = " <<
+            h.percentileUs(0.95) << " us, p99 = " << h.percentileUs(0.99) << " us, max = " << h.maxUs() <<
+            " us, mean = " << h.meanUs() << " us" << std::endl;
+    }
+}
+
+//======================================================================================================================
+LatencyHistogram LatencyTrace::total() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stages[NUM_STAGES - 1];
+}
+
+//======================================================================================================================
+void LatencyTrace::startPeriodic(int periodMs, const std::string &prefix) {
+    stopPeriodic();
+    flagStopPeriodic = false;
+    threadPeriodic = std::thread([this, periodMs, prefix] {
+        std::unique_lock<std::mutex> lock(mutexPeriodic);
+        while (!condPeriodic.wait_for(lock, std::chrono::milliseconds(periodMs), [this] { return flagStopPeriodic; }))
+            print(std::cout, prefix);
+    });
+}
+
+void LatencyTrace::stopPeriodic() {
+    if (!threadPeriodic.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutexPeriodic);
+        flagStopPeriodic = true;
+    }
+    condPeriodic.notify_all();
+    threadPeriodic.join();
+}
@@ -0,0 +1,126 @@
+//
+// Created by IT-JIM
+// LATENCY_TRACE: Per-buffer latency tracing through the bridge, keyed by PTS, with fixed log-scale histograms
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <ostream>
+
+#include <gst/gst.h>
+
+//======================================================================================================================
+/// Where a buffer is timestamped on its way from the goblin appsink to the elf sink
+enum class TracePoint {
+    /// Pulled from the goblin appsink
+    PULL = 0,
+    /// Processing started and finished
+    PROC_START,
+    PROC_END,
+    /// Just before gst_app_src_push_buffer()
+    PUSH,
+    /// Arrived at the elf sink pad
+    SINK,
+};
+
+//======================================================================================================================
+/// Latency histogram with fixed log-scale buckets: 8 per power of 2, from 1 us to about 18 minutes
+/// Adding a value is a few integer ops, no allocation; percentiles are accurate to 1/8 of an octave (~9%)
+class LatencyHistogram {
+public:
+    void add(int64_t ns);
+
+    int64_t count() const { return countValues; }
+
+    /// The p-th percentile (0..1) in microseconds: the upper bound of its bucket, but never above the max
+    double percentileUs(double p) const;
+
+    double meanUs() const { return countValues ? sumNs * 1e-3 / countValues : 0; }
+
+    double maxUs() const { return maxNs * 1e-3; }
+
+private:
+    static constexpr int SUB_BITS = 3;
+    static constexpr int NUM_BUCKETS = 1 + (30 << SUB_BITS);
+
+    int64_t buckets[NUM_BUCKETS] = {};
+    int64_t countValues = 0;
+    int64_t sumNs = 0;
+    int64_t maxNs = 0;
+};
+
+//======================================================================================================================
+/// Latency tracer of one stream
+/// Each buffer is marked at every TracePoint with its PTS, the intervals go into one histogram per stage
+/// Cheap enough to leave on: a fixed ring of in-flight slots, no allocation and no output per buffer
+class LatencyTrace {
+public:
+    ~LatencyTrace();
+
+    /// Tracing is off by default, then mark() does nothing
+    bool enabled = false;
+
+    /// Timestamp one buffer (by its PTS) at one point, buffers without a PTS are ignored
+    void mark(TracePoint point, GstClockTime pts) {
+        if (enabled && pts != GST_CLOCK_TIME_NONE)
+            markNow(point, pts);
+    }
+
+    void mark(TracePoint point, GstBuffer *buffer) {
+        if (enabled)
+            mark(point, GST_BUFFER_PTS(buffer));
+    }
+
+    void mark(TracePoint point, GstSample *sample) {
+        if (enabled)
+            mark(point, GST_BUFFER_PTS(gst_sample_get_buffer(sample)));
+    }
+
+    /// Add a probe on the sink pad of the elf sink element, which marks TracePoint::SINK
+    void attachSink(GstElement *sink);
+
+    /// Print the histograms of all stages
+    void print(std::ostream &out, const std::string &prefix);
+
+    /// A copy of the total (pull -> sink) histogram, e.g. for a benchmark report
+    LatencyHistogram total();
+
+    /// Print the histograms every periodMs from a thread of its own, until stopped or destroyed
+    void startPeriodic(int periodMs, const std::string &prefix);
+
+    void stopPeriodic();
+
+private:
+    void markNow(TracePoint point, GstClockTime pts);
+
+    static constexpr int NUM_POINTS = 5;
+    /// Buffers in flight at once, more than any queue between the goblin appsink and the elf sink
+    static constexpr int NUM_SLOTS = 256;
+
+    /// One buffer in flight: its PTS and the time at each point, 0 = not marked
+    struct Slot {
+        GstClockTime pts = GST_CLOCK_TIME_NONE;
+        int64_t tNs[NUM_POINTS] = {};
+    };
+
+    /// Protects everything below, marks come from several threads (processing, workers, elf streaming thread)
+    std::mutex mutex;
+    Slot slots[NUM_SLOTS];
+    /// Next slot for a new buffer
+    int head = 0;
+    /// Buffers which never reached the elf sink before their slot was reused
+    int64_t countLost = 0;
+
+    /// Stages: pull -> proc start -> proc end -> push -> sink, and the total pull -> sink
+    static constexpr int NUM_STAGES = NUM_POINTS;
+    LatencyHistogram stages[NUM_STAGES];
+
+    std::thread threadPeriodic;
+    std::mutex mutexPeriodic;
+    std::condition_variable condPeriodic;
+    bool flagStopPeriodic = false;
+};
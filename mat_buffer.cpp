@@ -0,0 +1,81 @@
+//
+// Created by IT-JIM
+// MAT_BUFFER: cv::Mat-backed GstBuffers, so that the frames made by OpenCV go to appsrc without a memcpy
+
+#include <algorithm>
+
+#include "my_assert.h"
+#include "mat_buffer.h"
+
+//======================================================================================================================
+/// What a wrapped buffer owns: a Mat reference, and the store to return the Mat to (if any)
+struct MatHolder {
+    cv::Mat frame;
+    std::shared_ptr<MatFrameStore> store;
+};
+
+//======================================================================================================================
+/// GDestroyNotify of the wrapped memory, called by GStreamer (any thread) when the buffer is freed
+static void releaseMat(gpointer userData) {
+    MatHolder *holder = (MatHolder *) userData;
+    if (holder->store) {
+        MatFrameStore &store = *holder->store;
+        std::lock_guard<std::mutex> lock(store.mutex);
+        if (store.frames.size() < store.maxFree)
+            store.frames.push_back(holder->frame);
+    }
+    delete holder;
+}
+
+//======================================================================================================================
+/// Wrap the frame data, the holder takes a reference
+static GstBuffer *wrapFrame(const cv::Mat &frame, const std::shared_ptr<MatFrameStore> &store) {
+    MY_ASSERT(!frame.empty());
+    MatHolder *holder = new MatHolder{frame.isContinuous() ? frame : frame.clone(), store};
+    gsize size = holder->frame.total() * holder->frame.elemSize();
+    return gst_buffer_new_wrapped_full(GstMemoryFlags(0), holder->frame.data, size, 0, size, holder, releaseMat);
+}
+
+//======================================================================================================================
+MatFramePool::MatFramePool(size_t maxFree) : store(std::make_shared<MatFrameStore>()) {
+    store->maxFree = maxFree;
+}
+
+//======================================================================================================================
+void MatFramePool::reserve(size_t count, int rows, int cols, int type) {
+    std::lock_guard<std::mutex> lock(store->mutex);
+    while (store->frames.size() < std::min(count, store->maxFree)) {
+        store->frames.emplace_back(rows, cols, type);
+        ++countNew;
+    }
+}
+
+//======================================================================================================================
+cv::Mat MatFramePool::acquire(int rows, int cols, int type) {
+    {
+        std::lock_guard<std::mutex> lock(store->mutex);
+        std::vector<cv::Mat> &frames = store->frames;
+        for (size_t i = 0; i < frames.size(); ++i) {
+            cv::Mat &f = frames[i];
+            // refcount 1 : only the store has it, nobody can still be reading or writing the data
+            if (f.rows == rows && f.cols == cols && f.type() == type && f.u && f.u->refcount == 1) {
+                cv::Mat frame = f;
+                frames.erase(frames.begin() + i);
+                ++countReuse;
+                return frame;
+            }
+        }
+    }
+    ++countNew;
+    return cv::Mat(rows, cols, type);
+}
+
+//======================================================================================================================
+GstBuffer *MatFramePool::wrap(const cv::Mat &frame) {
+    return wrapFrame(frame, store);
+}
+
+//======================================================================================================================
+GstBuffer *wrapMat(const cv::Mat &frame) {
+    return wrapFrame(frame, nullptr);
+}
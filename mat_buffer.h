@@ -0,0 +1,58 @@
+//
+// Created by IT-JIM
+// MAT_BUFFER: cv::Mat-backed GstBuffers, so that the frames made by OpenCV go to appsrc without a memcpy
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+#include <gst/gst.h>
+
+#include <opencv2/opencv.hpp>
+
+//======================================================================================================================
+/// Free frames for reuse, shared by the pool and all the buffers still in flight
+/// A buffer released after the pool is gone simply frees its Mat
+struct MatFrameStore {
+    std::mutex mutex;
+    std::vector<cv::Mat> frames;
+    size_t maxFree = 8;
+};
+
+//======================================================================================================================
+/// Recycled cv::Mat frames, handed to GStreamer as GstBuffers without copying
+/// acquire() a frame, fill it (e.g. VideoCapture::read() decodes right into it), then wrap() it and push the buffer
+/// When GStreamer releases the buffer, the frame goes back here and the next acquire() reuses its memory
+class MatFramePool {
+public:
+    /// Keep at most maxFree frames for reuse, the rest are freed
+    explicit MatFramePool(size_t maxFree = 8);
+
+    /// Allocate count free frames up front (at most maxFree are kept), so that acquire() never allocates
+    void reserve(size_t count, int rows, int cols, int type);
+
+    /// A frame of this size and type: a free one with no other references, or a new one
+    cv::Mat acquire(int rows, int cols, int type);
+
+    /// A buffer wrapping the frame data, it holds a Mat reference until GStreamer releases it
+    /// Drop your own references to the frame (e.g. acquire() the next one into the same variable),
+    /// or it's never reused; a non-continuous Mat (a ROI) is cloned first
+    GstBuffer *wrap(const cv::Mat &frame);
+
+    /// Frames allocated by acquire(), and frames reused
+    int64_t countAllocated() const { return countNew; }
+
+    int64_t countReused() const { return countReuse; }
+
+private:
+    std::shared_ptr<MatFrameStore> store;
+    std::atomic<int64_t> countNew{0};
+    std::atomic<int64_t> countReuse{0};
+};
+
+/// A buffer wrapping the Mat data without a pool: the Mat is held until GStreamer releases the buffer, then freed
+GstBuffer *wrapMat(const cv::Mat &frame);
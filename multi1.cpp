@@ -0,0 +1,198 @@
+//
+// Created by IT-JIM
+// MULTI1: Many goblin/elf pipeline pairs in one process, all samples processed on one work-stealing pool
+// Reports per-stream and aggregate throughput, to find the stream count at which one box saturates
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include <gst/gst.h>
+
+#include "gstbridge.h"
+
+//======================================================================================================================
+/// Sum of the pushed buffers and bytes over all streams
+void sumPushed(const std::vector<BridgeStream *> &streams, int64_t &buffers, int64_t &bytes) {
+    buffers = bytes = 0;
+    for (BridgeStream *stream : streams) {
+        buffers += stream->countPushed;
+        bytes += stream->bytesPushed;
+    }
+}
+
+//======================================================================================================================
+/// Print the aggregate throughput and the pool load every periodMs, until stopped
+void codeThreadReport(const std::vector<BridgeStream *> &streams, const WorkPool &pool, int periodMs,
+                      std::mutex &mutexStop, std::condition_variable &condStop, bool &flagStop) {
+    using namespace std;
+    int64_t buffers0, bytes0;
+    sumPushed(streams, buffers0, bytes0);
+    int64_t busy0 = pool.stats().busyNs;
+    int64_t t0 = nowNs();
+    unique_lock<mutex> lock(mutexStop);
+    while (!condStop.wait_for(lock, chrono::milliseconds(periodMs), [&flagStop]{ return flagStop; })) {
+        int64_t buffers1, bytes1;
+        sumPushed(streams, buffers1, bytes1);
+        int64_t busy1 = pool.stats().busyNs;
+        int64_t t1 = nowNs();
+        double sec = (t1 - t0) * 1e-9;
+        int active = 0;
+        for (BridgeStream *stream : streams)
+            if (stream->tEndNs == 0)
+                ++active;
+        logFlush();
+        cout << "MULTI : streams active = " << active << " / " << streams.size() << ", " <<
+             (buffers1 - buffers0) / sec << " buffers/s, " << (bytes1 - bytes0) / sec * 1e-6 << " MB/s, pool load = " <<
+             100.0 * (busy1 - busy0) / (t1 - t0) / pool.size() << " %" << endl;
+        buffers0 = buffers1;
+        bytes0 = bytes1;
+        busy0 = busy1;
+        t0 = t1;
+    }
+}
+
+//======================================================================================================================
+int main(int argc, char **argv) {
+    using namespace std;
+    cout << "MULTI1: Many goblin/elf pipeline pairs in one process, on one work-stealing pool" << endl;
+
+    // Init gstreamer
+    gst_init(&argc, &argv);
+
+    if (argc < 2) {
+        cout << "Usage:\nmulti1 <video_file|@list_file> ... [--repeat <n>] [--threads <n>] [--copy] [--passthrough]\n" <<
+                "       [--bgr] [--elf <pipeline>] [--report-every <ms>] [bridge options]" << endl;
+        cout << "  @list_file : a text file with one input per line" << endl;
+        cout << "  --repeat <n> : run each input n times, e.g. to find how many streams one box can take" << endl;
+        cout << "  --threads <n> : work pool threads, default one per core" << endl;
+        cout << "  --copy : process frames in a copy, not in the goblin buffer" << endl;
+        cout << "  --passthrough : do not process frames, forward them by reference" << endl;
+        cout << "  --bgr : process in BGR, not in the decoder's I420/NV12 (colorspace conversions in every stream)" << endl;
+        cout << "  --elf <pipeline> : elf pipeline with appsrc name=elf_src and a sink name=elf_sink," << endl;
+        cout << "                     default: appsrc name=elf_src format=time ! fakesink name=elf_sink sync=false" << endl;
+        cout << "  --report-every <ms> : print the aggregate throughput every <ms>, default 1000" << endl;
+        printBridgeUsage();
+        return 0;
+    }
+
+    vector<string> inputs;
+    BridgeOptions opts;
+    int repeat = 1, numThreads = 0, reportMs = 1000;
+    bool inPlace = true, passthrough = false, bgr = false;
+    string pipeStrElf = "appsrc name=elf_src format=time ! fakesink name=elf_sink sync=false";
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "--repeat" && i + 1 < argc) {
+            if (!parseIntArg(argv[++i], repeat, 1))
+                cout << "Bad value for " << arg << " : " << argv[i] << endl;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            if (!parseIntArg(argv[++i], numThreads))
+                cout << "Bad value for " << arg << " : " << argv[i] << endl;
+        } else if (arg == "--copy")
+            inPlace = false;
+        else if (arg == "--passthrough")
+            passthrough = true;
+        else if (arg == "--bgr")
+            bgr = true;
+        else if (arg == "--elf" && i + 1 < argc)
+            pipeStrElf = argv[++i];
+        else if (arg == "--report-every" && i + 1 < argc) {
+            if (!parseIntArg(argv[++i], reportMs))
+                cout << "Bad value for " << arg << " : " << argv[i] << endl;
+        } else if (parseBridgeOption(opts, i, argc, argv))
+            continue;
+        else if (arg.compare(0, 2, "--") == 0)
+            cout << "Unknown option : " << arg << endl;
+        else if (arg[0] == '@') {
+            ifstream in(arg.substr(1));
+            MY_ASSERT(in.good());
+            string line;
+            while (getline(in, line))
+                if (!line.empty())
+                    inputs.push_back(line);
+        } else
+            inputs.push_back(arg);
+    }
+    MY_ASSERT(!inputs.empty() && repeat > 0);
+
+    // Shared by all streams: one bus thread, one pool of processing threads
+    BusDispatcher bus;
+    WorkPool pool(numThreads);
+    cout << "Streams : " << inputs.size() * repeat << ", pool threads : " << pool.size() << endl;
+
+    // One pair of pipelines per input, no threads of their own
+    // sync=false : run as fast as possible, we measure throughput, not playback
+    vector<unique_ptr<BridgeEngine>> engines;
+    vector<BridgeStream *> streams;
+    for (int r = 0; r < repeat; ++r)
+        for (const string &fileName : inputs) {
+            string name = "#" + to_string(engines.size()) + " ";
+            string pipeStrGoblin = "filesrc location=" + fileName +
+                                   " ! decodebin ! videoconvert ! appsink name=goblin_sink max-buffers=2 sync=false enable-last-sample=false caps=\"" +
+                                   bridgeVideoCaps(bgr) + "\"";
+            engines.emplace_back(new BridgeEngine(pipeStrGoblin, pipeStrElf));
+            BridgeEngine &engine = *engines.back();
+            engine.busDispatcher = &bus;
+            engine.workPool = &pool;
+            engine.busPrefix = name;
+            BridgeStream &stream = engine.addStream(opts, "goblin_sink", "elf_src", "elf_sink", name + ": ");
+            stream.passthrough = passthrough;
+            stream.process = [inPlace](BridgeStream &stream, GstSample *sample) {
+                return processBufferInvertRoi(stream, sample, inPlace);
+            };
+            streams.push_back(&stream);
+        }
+
+    // Go !
+    int64_t t0 = nowNs();
+    for (auto &engine : engines)
+        engine->start();
+
+    mutex mutexStop;
+    condition_variable condStop;
+    bool flagStop = false;
+    thread threadReport([&]{
+        codeThreadReport(streams, pool, reportMs, mutexStop, condStop, flagStop);
+    });
+
+    for (auto &engine : engines)
+        engine->wait();
+    int64_t t1 = nowNs();
+    {
+        lock_guard<mutex> lock(mutexStop);
+        flagStop = true;
+    }
+    condStop.notify_all();
+    threadReport.join();
+    logFlush();
+
+    // Per-stream throughput
+    for (BridgeStream *stream : streams) {
+        double sec = (stream->tEndNs - stream->tStartNs) * 1e-9;
+        cout << stream->prefix << "buffers = " << stream->countPushed << ", time = " << sec << " s, " <<
+             (sec > 0 ? stream->countPushed / sec : 0) << " buffers/s, " <<
+             (sec > 0 ? stream->bytesPushed / sec * 1e-6 : 0) << " MB/s" << endl;
+        if (opts.trace)
+            stream->trace.print(cout, stream->prefix);
+    }
+
+    // Aggregate throughput and the pool load
+    int64_t buffers, bytes;
+    sumPushed(streams, buffers, bytes);
+    double sec = (t1 - t0) * 1e-9;
+    WorkPool::Stats ps = pool.stats();
+    cout << "TOTAL : streams = " << streams.size() << ", buffers = " << buffers << ", time = " << sec << " s, " <<
+         buffers / sec << " buffers/s, " << bytes / sec * 1e-6 << " MB/s" << endl;
+    cout << "POOL : threads = " << pool.size() << ", tasks = " << ps.countTasks << ", steals = " << ps.countSteals <<
+         ", load = " << 100.0 * ps.busyNs / (t1 - t0) / pool.size() << " %" << endl;
+
+    return 0;
+}
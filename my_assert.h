@@ -0,0 +1,17 @@
+//
+// Created by IT-JIM
+// MY_ASSERT: The assertion of the bridge modules, without pulling in the whole gstbridge.h
+
+#pragma once
+
+#include <string>
+#include <stdexcept>
+
+//======================================================================================================================
+/// A simple assertion function + macro
+inline void myAssert(bool b, const std::string &s = "MYASSERT ERROR !") {
+    if (!b)
+        throw std::runtime_error(s);
+}
+
+#define MY_ASSERT(x) myAssert(x, "MYASSERT ERROR :" #x)
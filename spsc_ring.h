@@ -0,0 +1,121 @@
+//
+// Created by IT-JIM
+// SPSC_RING: Bounded lock-free single producer single consumer ring, with blocking push/pop for the slow path
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include "clock_ns.h"
+
+//======================================================================================================================
+/// Bounded ring between exactly one producer thread and one consumer thread
+/// tryPush()/tryPop() never lock; push()/pop() sleep on a condition variable only when the ring is full/empty,
+/// and the other side takes the mutex to wake them only if somebody actually sleeps
+template<typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) : slots(capacity), capacity(capacity) {}
+
+    SpscRing(const SpscRing &) = delete;
+
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    /// Producer: add an item, return false if the ring is full (the item is not moved then)
+    bool tryPush(T &item) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == capacity)
+            return false;
+        slots[h % capacity] = std::move(item);
+        head.store(h + 1);
+        wake();
+        return true;
+    }
+
+    /// Consumer: take an item, return false if the ring is empty
+    bool tryPop(T &item) {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+            return false;
+        item = std::move(slots[t % capacity]);
+        tail.store(t + 1);
+        wake();
+        return true;
+    }
+
+    /// Producer: add an item, wait while the ring is full; return the time waited in ns (0 = no wait)
+    int64_t push(T &item) {
+        if (tryPush(item))
+            return 0;
+        int64_t t0 = nowNs();
+        while (!tryPush(item))
+            sleepUntil([this]{ return head.load() - tail.load() < capacity; });
+        return nowNs() - t0;
+    }
+
+    /// Consumer: take an item, wait while the ring is empty; false if it's empty and closed
+    /// waitedNs gets the time waited
+    bool pop(T &item, int64_t &waitedNs) {
+        waitedNs = 0;
+        if (tryPop(item))
+            return true;
+        int64_t t0 = nowNs();
+        for (;;) {
+            // Check closed before the last try: everything pushed before close() is still taken
+            bool last = closed.load();
+            if (tryPop(item))
+                break;
+            if (last) {
+                waitedNs = nowNs() - t0;
+                return false;
+            }
+            sleepUntil([this]{ return head.load() != tail.load() || closed.load(); });
+        }
+        waitedNs = nowNs() - t0;
+        return true;
+    }
+
+    /// Producer: no more items, pop() returns false once the ring is empty
+    void close() {
+        closed = true;
+        wake();
+    }
+
+    size_t size() const { return size_t(head.load() - tail.load()); }
+
+private:
+    /// Sleep until the condition is true; the waiter count makes the other side notify
+    template<typename Pred>
+    void sleepUntil(Pred pred) {
+        std::unique_lock<std::mutex> lock(mutex);
+        ++waiters;
+        cond.wait(lock, pred);
+        --waiters;
+    }
+
+    /// Wake the other side if it sleeps
+    /// head/tail stores and this load are seq_cst: either we see the waiter, or it sees our update
+    void wake() {
+        if (waiters.load() > 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            cond.notify_all();
+        }
+    }
+
+    std::vector<T> slots;
+    const size_t capacity;
+    /// Next slot to write (producer) and to read (consumer), they only grow
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> tail{0};
+    std::atomic_bool closed{false};
+
+    /// The slow path only
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::atomic_int waiters{0};
+};
@@ -4,150 +4,104 @@
 #include <iostream>
 #include <string>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include <gst/gst.h>
-#include <gst/app/gstappsink.h>
-
 
 #include <opencv2/opencv.hpp>
 
-//======================================================================================================================
-/// A simple assertion function + macro
-inline void myAssert(bool b, const std::string &s = "MYASSERT ERROR !") {
-    if (!b)
-        throw std::runtime_error(s);
-}
-
-#define MY_ASSERT(x) myAssert(x, "MYASSERT ERROR :" #x)
+#include "gstbridge.h"
 
 //======================================================================================================================
-/// Check GStreamer error, exit on error
-inline void checkErr(GError *err) {
-    if (err) {
-        std::cerr << "checkErr : " << err->message << std::endl;
-        exit(0);
+/// Single-slot mailbox between the appsink thread and the display: the latest frame wins
+/// post() never waits, it replaces a frame not shown yet (dropped), so slow rendering never backs up the decoding
+class FrameMailbox {
+public:
+    ~FrameMailbox() {
+        if (sample)
+            gst_sample_unref(sample);
     }
-}
 
-//======================================================================================================================
-/// Our global data, serious gstreamer apps should always have this !
-struct GoblinData {
-    GstElement *pipeline = nullptr;
-    GstElement *sinkVideo = nullptr;
-};
+    /// Producer: leave the sample (takes ownership) with the video info it was parsed with
+    void post(GstSample *s, const GstVideoInfo &i) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (sample) {
+            gst_sample_unref(sample);
+            ++countDropped;
+        }
+        sample = s;
+        info = i;
+        cond.notify_one();
+    }
 
-//======================================================================================================================
-/// Process a single bus message, log messages, exit on error, return false on eof
-static bool busProcessMsg(GstElement *pipeline, GstMessage *msg, const std::string &prefix) {
-    using namespace std;
+    /// Consumer: wait for a sample (ownership goes to the caller); nullptr if the mailbox is closed and empty
+    GstSample *take(GstVideoInfo &i) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this]{ return sample != nullptr || closed; });
+        GstSample *s = sample;
+        sample = nullptr;
+        i = info;
+        return s;
+    }
 
-    GstMessageType mType = GST_MESSAGE_TYPE(msg);
-    cout << "[" << prefix << "] : mType = " << mType << " ";
-    switch (mType) {
-        case (GST_MESSAGE_ERROR):
-            // Parse error and exit program, hard exit
-            GError *err;
-            gchar *dbg;
-            gst_message_parse_error(msg, &err, &dbg);
-            cout << "ERR = " << err->message << " FROM " << GST_OBJECT_NAME(msg->src) << endl;
-            cout << "DBG = " << dbg << endl;
-            g_clear_error(&err);
-            g_free(dbg);
-            exit(1);
-        case (GST_MESSAGE_EOS) :
-            // Soft exit on EOS
-            cout << " EOS !" << endl;
-            return false;
-        case (GST_MESSAGE_STATE_CHANGED):
-            // Parse state change, print extra info for pipeline only
-            cout << "State changed !" << endl;
-            if (GST_MESSAGE_SRC(msg) == GST_OBJECT(pipeline)) {
-                GstState sOld, sNew, sPenging;
-                gst_message_parse_state_changed(msg, &sOld, &sNew, &sPenging);
-                cout << "Pipeline changed from " << gst_element_state_get_name(sOld) << " to " <<
-                     gst_element_state_get_name(sNew) << endl;
-            }
-            break;
-        case (GST_MESSAGE_STEP_START):
-            cout << "STEP START !" << endl;
-            break;
-        case (GST_MESSAGE_STREAM_STATUS):
-            cout << "STREAM STATUS !" << endl;
-            break;
-        case (GST_MESSAGE_ELEMENT):
-            cout << "MESSAGE ELEMENT !" << endl;
-            break;
-
-            // You can add more stuff here if you want
-
-        default:
-            cout << endl;
+    /// No more samples, take() returns nullptr once the last one is taken
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        cond.notify_one();
     }
-    return true;
-}
+
+    int64_t dropped() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return countDropped;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable cond;
+    GstSample *sample = nullptr;
+    GstVideoInfo info;
+    bool closed = false;
+    int64_t countDropped = 0;
+};
 
 //======================================================================================================================
-/// Run the message loop for one bus
-void codeThreadBus(GstElement *pipeline, GoblinData &data, const std::string &prefix) {
-    using namespace std;
-    GstBus *bus = gst_element_get_bus(pipeline);
-
-    int res;
-    while (true) {
-        GstMessage *msg = gst_bus_timed_pop(bus, GST_CLOCK_TIME_NONE);
-        MY_ASSERT(msg);
-        res = busProcessMsg(pipeline, msg, prefix);
-        gst_message_unref(msg);
-        if (!res)
-            break;
+/// Wrap the mapped BGR data in an OpenCV frame, false if the buffer is too small for the caps
+static bool mapFrame(GstBuffer *buffer, GstMapInfo &m, const GstVideoInfo &info, cv::Mat &frame) {
+    int imW = GST_VIDEO_INFO_WIDTH(&info), imH = GST_VIDEO_INFO_HEIGHT(&info);
+    size_t stride = GST_VIDEO_INFO_PLANE_STRIDE(&info, 0);
+    LOG_DEBUG << "Sample: W = " << imW << ", H = " << imH;
+    if (m.size < GST_VIDEO_INFO_SIZE(&info)) {
+        LOG_WARN << "Buffer size " << m.size << " < " << GST_VIDEO_INFO_SIZE(&info) << ", skipped";
+        return false;
     }
-    gst_object_unref(bus);
-    cout << "BUS THREAD FINISHED : " << prefix << endl;
+    frame = cv::Mat(imH, imW, CV_8UC3, (void *) m.data, stride);
+    return true;
 }
 
 //======================================================================================================================
-/// Appsink process thread
-void codeThreadProcessV(GoblinData &data) {
-    using namespace std;
-    for (;;) {
-        // Exit on EOS
-        if (gst_app_sink_is_eos(GST_APP_SINK(data.sinkVideo))) {
-            cout << "EOS !" << endl;
-            break;
-        }
-
-        // Pull the sample (synchronous, wait)
-        GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(data.sinkVideo));
-        if (sample == nullptr) {
-            cout << "NO sample !" << endl;
-            break;
-        }
-
-        // Get width and height from sample caps (NOT element caps)
-        GstCaps *caps = gst_sample_get_caps(sample);
-        MY_ASSERT(caps != nullptr);
-        GstStructure *s = gst_caps_get_structure(caps, 0);
-        int imW, imH;
-        MY_ASSERT(gst_structure_get_int(s, "width", &imW));
-        MY_ASSERT(gst_structure_get_int(s, "height", &imH));
-        cout << "Sample: W = " << imW << ", H = " << imH << endl;
-
-//        cout << "sample !" << endl;
+/// Display loop, on the main thread (the GUI wants it): show the latest frame until the mailbox is closed
+void displayLoop(FrameMailbox &mailbox) {
+    int countShown = 0;
+    GstVideoInfo info;
+    while (GstSample *sample = mailbox.take(info)) {
         // Process the sample
         // "buffer" and "map" are used to access raw data in the sample
         // "buffer" is a single data chunk, for raw video it's 1 frame
         // "buffer" is NOT a queue !
         // "Map" is the helper to access raw data in the buffer
+        // The buffer is mapped here, in the display thread, the appsink thread has long moved on
         GstBuffer *buffer = gst_sample_get_buffer(sample);
         GstMapInfo m;
         MY_ASSERT(gst_buffer_map(buffer, &m, GST_MAP_READ));
-        MY_ASSERT(m.size == imW * imH * 3);
-//        cout << "size = " << map.size << " ==? " << imW*imH*3 << endl;
-
-        // Wrap the raw data in OpenCV frame and show on screen
-        cv::Mat frame(imH, imW, CV_8UC3, (void *) m.data);
-        cv::imshow("frame", frame);
-        int key = cv::waitKey(1);
+        int key = -1;
+        cv::Mat frame;
+        if (mapFrame(buffer, m, info, frame)) {
+            cv::imshow("frame", frame);
+            key = cv::waitKey(1);
+            ++countShown;
+        }
 
         // Don't forget to unmap the buffer and unref the sample
         gst_buffer_unmap(buffer, &m);
@@ -155,6 +109,38 @@ void codeThreadProcessV(GoblinData &data) {
         if (27 == key)
             exit(0);
     }
+    LOG_INFO << "Display : shown = " << countShown << ", dropped = " << mailbox.dropped();
+}
+
+//======================================================================================================================
+/// Headless frame counter and the arrival time of the last frame
+struct FrameStats {
+    int64_t countFrames = 0;
+    int64_t tLastNs = -1;
+};
+
+//======================================================================================================================
+/// Headless: no display, log the statistics of each frame instead
+/// There is no elf pipeline here, so we return no buffer
+GstBuffer *statSampleV(BridgeStream &stream, GstSample *sample, FrameStats &stats) {
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstMapInfo m;
+    MY_ASSERT(gst_buffer_map(buffer, &m, GST_MAP_READ));
+    cv::Mat frame;
+    if (mapFrame(buffer, m, stream.videoInfo, frame)) {
+        // Mean color, and the wall time since the previous frame
+        cv::Scalar mean = cv::mean(frame);
+        int64_t tNs = nowNs();
+        double dtMs = stats.tLastNs < 0 ? 0 : (tNs - stats.tLastNs) * 1e-6;
+        stats.tLastNs = tNs;
+        LOG_INFO << "Frame " << stats.countFrames << " : pts = " << GST_BUFFER_PTS(buffer) * 1e-9 << " s, " <<
+                 frame.cols << "x" << frame.rows << ", dt = " << dtMs << " ms, mean BGR = " <<
+                 mean[0] << " " << mean[1] << " " << mean[2];
+        ++stats.countFrames;
+    }
+    gst_buffer_unmap(buffer, &m);
+    gst_sample_unref(sample);
+    return nullptr;
 }
 
 //======================================================================================================================
@@ -165,15 +151,26 @@ int main(int argc, char **argv) {
     // Init gstreamer
     gst_init(&argc, &argv);
 
-    if (argc != 2) {
-        cout << "Usage:\nvideo1 <video_file>" << endl;
+    if (argc < 2) {
+        cout << "Usage:\nvideo1 <video_file> [--headless] [bridge options]" << endl;
+        cout << "  --headless : no display, print the statistics of each frame" << endl;
+        printBridgeUsage();
         return 0;
     }
     string fileName(argv[1]);
     cout << "Playing file : " << fileName << endl;
 
-    // Our global data
-    GoblinData data;
+    BridgeOptions opts;
+    bool headless = false;
+    for (int i = 2; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "--headless")
+            headless = true;
+        else if (!parseBridgeOption(opts, i, argc, argv))
+            cout << "Unknown option : " << arg << endl;
+    }
+    // The frames must reach the mailbox (or the log) in order
+    opts.numWorkers = 0;
 
     // Set up the pipeline
     // Caps in appsink are important
@@ -181,34 +178,36 @@ int main(int argc, char **argv) {
     // sync=1 for real-time playback, try sync=0 for fun !
     string pipeStr = "filesrc location=" + fileName +
                      " ! decodebin ! videoconvert ! appsink name=mysink max-buffers=2 sync=1 caps=video/x-raw,format=BGR";
-    GError *err = nullptr;
-    data.pipeline = gst_parse_launch(pipeStr.c_str(), &err);
-    checkErr(err);
-    MY_ASSERT(data.pipeline);
-    // Find our appsink by name
-    data.sinkVideo = gst_bin_get_by_name(GST_BIN (data.pipeline), "mysink");
-    MY_ASSERT(data.sinkVideo);
-
-    // Play the pipeline
-    MY_ASSERT(gst_element_set_state(data.pipeline, GST_STATE_PLAYING));
-
-    // Start the bus thread
-    thread threadBus([&data]() -> void {
-        codeThreadBus(data.pipeline, data, "GOBLIN");
-    });
-
-    // Start the appsink process thread
-    thread threadProcess([&data]() -> void {
-        codeThreadProcessV(data);
-    });
 
-    // Wait for threads
-    threadBus.join();
-    threadProcess.join();
+    // A goblin pipeline only, without elf
+    BridgeEngine engine(pipeStr, "");
+    BridgeStream &streamV = engine.addStream(opts, "mysink", "", "");
+    if (headless) {
+        FrameStats stats;
+        streamV.process = [&stats](BridgeStream &stream, GstSample *sample) {
+            return statSampleV(stream, sample, stats);
+        };
+        // Play, run until EOS
+        engine.run();
+        LOG_INFO << "Frames : " << stats.countFrames;
+        return 0;
+    }
 
-    // Destroy the pipeline
-    gst_element_set_state(data.pipeline, GST_STATE_NULL);
-    gst_object_unref(data.pipeline);
+    // The appsink thread only drops the samples into the mailbox, cv::imshow() runs here
+    FrameMailbox mailbox;
+    streamV.process = [&mailbox](BridgeStream &stream, GstSample *sample) -> GstBuffer * {
+        mailbox.post(sample, stream.videoInfo);
+        return nullptr;
+    };
+
+    // Play, show frames until EOS
+    engine.start();
+    thread threadWait([&engine, &mailbox]{
+        engine.wait();
+        mailbox.close();
+    });
+    displayLoop(mailbox);
+    threadWait.join();
 
     return 0;
-}
\ No newline at end of file
+}
@@ -4,125 +4,55 @@
 
 #include <iostream>
 #include <string>
-#include <thread>
-#include <atomic>
 #include <cmath>
 #include <sstream>
+#include <thread>
 
 #include <gst/gst.h>
-#include <gst/app/gstappsrc.h>
 
 #include <opencv2/opencv.hpp>
 
-//======================================================================================================================
-/// A simple assertion function + macro
-inline void myAssert(bool b, const std::string &s = "MYASSERT ERROR !") {
-    if (!b)
-        throw std::runtime_error(s);
-}
-
-#define MY_ASSERT(x) myAssert(x, "MYASSERT ERROR :" #x)
+#include "gstbridge.h"
+#include "mat_buffer.h"
+#include "spsc_ring.h"
 
 //======================================================================================================================
-/// Check GStreamer error, exit on error
-inline void checkErr(GError *err) {
-    if (err) {
-        std::cerr << "checkErr : " << err->message << std::endl;
-        exit(0);
-    }
-}
-
-//======================================================================================================================
-/// Our global data, serious gstreamer apps should always have this !
-struct GoblinData {
-    /// pipeline
-    GstElement *pipeline = nullptr;
-    /// appsrc
-    GstElement *srcVideo = nullptr;
-    /// Video file name
-    std::string fileName;
-    /// Appsrc flag: when it's true, send the frames
-    std::atomic_bool flagRunV{false};
-
+/// One decoded frame in the decode-ahead ring
+struct DecodedFrame {
+    cv::Mat frame;
+    GstClockTime pts = 0;
 };
 
 //======================================================================================================================
-/// Process a single bus message, log messages, exit on error, return false on eof
-static bool busProcessMsg(GstElement *pipeline, GstMessage *msg, const std::string &prefix) {
-    using namespace std;
-
-    GstMessageType mType = GST_MESSAGE_TYPE(msg);
-    cout << "[" << prefix << "] : mType = " << mType << " ";
-    switch (mType) {
-        case (GST_MESSAGE_ERROR):
-            // Parse error and exit program, hard exit
-            GError *err;
-            gchar *dbg;
-            gst_message_parse_error(msg, &err, &dbg);
-            cout << "ERR = " << err->message << " FROM " << GST_OBJECT_NAME(msg->src) << endl;
-            cout << "DBG = " << dbg << endl;
-            g_clear_error(&err);
-            g_free(dbg);
-            exit(1);
-        case (GST_MESSAGE_EOS) :
-            // Soft exit on EOS
-            cout << " EOS !" << endl;
-            return false;
-        case (GST_MESSAGE_STATE_CHANGED):
-            // Parse state change, print extra info for pipeline only
-            cout << "State changed !" << endl;
-            if (GST_MESSAGE_SRC(msg) == GST_OBJECT(pipeline)) {
-                GstState sOld, sNew, sPenging;
-                gst_message_parse_state_changed(msg, &sOld, &sNew, &sPenging);
-                cout << "Pipeline changed from " << gst_element_state_get_name(sOld) << " to " <<
-                     gst_element_state_get_name(sNew) << endl;
-            }
-            break;
-        case (GST_MESSAGE_STEP_START):
-            cout << "STEP START !" << endl;
-            break;
-        case (GST_MESSAGE_STREAM_STATUS):
-            cout << "STREAM STATUS !" << endl;
-            break;
-        case (GST_MESSAGE_ELEMENT):
-            cout << "MESSAGE ELEMENT !" << endl;
-            break;
-
-            // You can add more stuff here if you want
-
-        default:
-            cout << endl;
-    }
-    return true;
-}
-
-//======================================================================================================================
-/// Run the message loop for one bus
-void codeThreadBus(GstElement *pipeline, GoblinData &data, const std::string &prefix) {
-    using namespace std;
-    GstBus *bus = gst_element_get_bus(pipeline);
-
-    int res;
-    while (true) {
-        GstMessage *msg = gst_bus_timed_pop(bus, GST_CLOCK_TIME_NONE);
-        MY_ASSERT(msg);
-        res = busProcessMsg(pipeline, msg, prefix);
-        gst_message_unref(msg);
-        if (!res)
+/// Decoder thread: read frames with opencv into pool frames, as far ahead as the ring allows
+/// Stalls only when the ring is full, i.e. the feeder (the pipeline) is slower than decoding
+void codeThreadDecode(cv::VideoCapture &video, MatFramePool &pool, SpscRing<DecodedFrame> &ring, int imW, int imH,
+                      double fps, int64_t &stallNs) {
+    for (int frameCount = 0;; ++frameCount) {
+        // Read a frame from the video into a free frame of the pool
+        // Never read into a frame we have pushed: GStreamer might still be using its data
+        DecodedFrame item;
+        item.frame = pool.acquire(imH, imW, CV_8UC3);
+        video.read(item.frame);
+        if (item.frame.empty())
             break;
+        // Set up timestamp
+        // This is not strictly required, but you need it for the correct 1x playback with sync=1 !
+        item.pts = uint64_t(frameCount / fps * GST_SECOND);
+        stallNs += ring.push(item);
     }
-    gst_object_unref(bus);
-    cout << "BUS THREAD FINISHED : " << prefix << endl;
+    ring.close();
 }
 
 //======================================================================================================================
 /// Read a video file with opencv and send data to appsrc
-void codeThreadSrcV(GoblinData &data) {
+/// Two threads: the decoder fills a ring of frames ahead, this one (the feeder) drains it when appsrc wants data
+void codeThreadSrcV(BridgeStream &stream, const std::string &fileName, int depth) {
     using namespace std;
     using namespace cv;
 
     // Open the video file with opencv
-    VideoCapture video(data.fileName);
+    VideoCapture video(fileName);
     MY_ASSERT(video.isOpened());
 
     // Find width, height, FPS
@@ -135,70 +65,54 @@ void codeThreadSrcV(GoblinData &data) {
     // Otherwise, the pipeline will not work !
     ostringstream oss;
     oss << "video/x-raw,format=BGR,width=" << imW << ",height=" << imH << ",framerate=" << int(lround(fps)) << "/1";
-    cout << "CAPS=" << oss.str() << endl;
+    LOG_INFO << "CAPS=" << oss.str();
+    // The engine plays the pipeline AFTER we have set up the final caps
     GstCaps *capsVideo = gst_caps_from_string(oss.str().c_str());
-    g_object_set(data.srcVideo, "caps", capsVideo, nullptr);
+    stream.engine->initElf(stream, capsVideo);
     gst_caps_unref(capsVideo);
 
-    // Play the pipeline AFTER we have set up the final caps
-    MY_ASSERT(gst_element_set_state(data.pipeline, GST_STATE_PLAYING));
+    // The frames come from a pool: opencv decodes right into a recycled Mat, which then goes to appsrc as it is
+    // Preallocated: the frames in the ring, plus a few in appsrc and downstream
+    MatFramePool pool(depth + 4);
+    pool.reserve(depth + 4, imH, imW, CV_8UC3);
+    SpscRing<DecodedFrame> ring(depth);
+    int64_t decodeStallNs = 0, feedStallNs = 0;
+    thread threadDecode([&]{
+        codeThreadDecode(video, pool, ring, imW, imH, fps, decodeStallNs);
+    });
 
     // Frame loop
     int frameCount = 0;
-    Mat frame;
     for (;;) {
-        // If the flag is false, go idle and wait, the pipeline does not want data for now
-        if (!data.flagRunV) {
-            cout << "(wait)" << endl;
-            this_thread::sleep_for(chrono::milliseconds(10));
-            continue;
-        }
-
-        // Read a frame from the video
-        video.read(frame);
-        if (frame.empty())
+        // If the gate is closed, go idle and wait, the pipeline does not want data for now
+        // The decoder keeps going meanwhile, until the ring is full
+        stream.engine->waitFeed(stream);
+
+        // Take the next decoded frame, we stall here only if the decoder is behind
+        DecodedFrame item;
+        int64_t waitedNs;
+        if (!ring.pop(item, waitedNs))
             break;
+        feedStallNs += waitedNs;
 
-        // Create a GStreamer buffer and copy data to it via a map
-        int bufferSize = frame.cols * frame.rows * 3;
-        GstBuffer *buffer = gst_buffer_new_and_alloc(bufferSize);
-        GstMapInfo m;
-        gst_buffer_map(buffer, &m, GST_MAP_WRITE);
-        memcpy(m.data, frame.data, bufferSize);
-        gst_buffer_unmap(buffer, &m);
-
-        // Set up timestamp
-        // This is not strictly required, but you need it for the correct 1x playback with sync=1 !
-        buffer->pts = uint64_t(frameCount  / fps * GST_SECOND);
+        // Wrap the frame in a GStreamer buffer, no copy
+        // The buffer holds the Mat until GStreamer is done with it, then the frame goes back to the pool
+        GstBuffer *buffer = pool.wrap(item.frame);
+        item.frame.release();
+        buffer->pts = item.pts;
+        // There is no appsink here, so the latency trace starts when the frame is ready
+        stream.trace.mark(TracePoint::PULL, buffer);
 
         // Send buffer to gstreamer
-        GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(data.srcVideo), buffer);
+        stream.engine->push(stream, buffer);
 
         ++frameCount;
     }
-
-    // Signal EOF to the pipeline
-    gst_app_src_end_of_stream(GST_APP_SRC(data.srcVideo));
-}
-
-//======================================================================================================================
-/// Callback called when the pipeline wants more data
-static void startFeed(GstElement *source, guint size, GoblinData *data) {
-    using namespace std;
-    if (!data->flagRunV) {
-        cout << "startFeed !" << endl;
-        data->flagRunV = true;
-    }
-}
-
-//======================================================================================================================
-/// Callback called when the pipeline wants no more data for now
-static void stopFeed(GstElement *source, GoblinData *data) {
-    using namespace std;
-    if (data->flagRunV) {
-        cout << "stopFeed !" << endl;
-        data->flagRunV = false;
-    }
+    threadDecode.join();
+    LOG_INFO << "Frames : " << frameCount << ", allocated = " << pool.countAllocated() << ", reused = " << pool.countReused();
+    LOG_INFO << "Ring depth " << depth << " : decode stall = " << decodeStallNs * 1e-6 << " ms (ring full, feed is slower), " <<
+             "feed stall = " << feedStallNs * 1e-6 << " ms (ring empty, decode is slower)";
+    // The engine signals EOF to the pipeline when we return
 }
 
 //======================================================================================================================
@@ -209,52 +123,44 @@ int main(int argc, char **argv) {
     // Init gstreamer
     gst_init(&argc, &argv);
 
-    if (argc != 2) {
-        cout << "Usage:\nvideo2 <video_file>" << endl;
+    if (argc < 2) {
+        cout << "Usage:\nvideo2 <video_file> [--depth <n>] [bridge options]" << endl;
+        cout << "  --depth <n> : decode up to n frames ahead of the pipeline, default 4" << endl;
+        printBridgeUsage();
         return 0;
     }
-
-    // Our global data
-    GoblinData data;
-    data.fileName = argv[1];
-    cout << "Playing file : " << data.fileName << endl;
+    string fileName(argv[1]);
+    BridgeOptions opts;
+    int depth = 4;
+    for (int i = 2; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "--depth" && i + 1 < argc) {
+            if (!parseIntArg(argv[++i], depth, 1))
+                cout << "Bad value for " << arg << " : " << argv[i] << endl;
+        } else if (!parseBridgeOption(opts, i, argc, argv))
+            cout << "Unknown option : " << arg << endl;
+    }
+    MY_ASSERT(depth > 0);
+    cout << "Playing file : " << fileName << endl;
 
     // Create GSTreamer pipeline
     // Note: we don't know image size or framerate yet !
     // We'll give preliminary caps only which we will replace later
     // format=time is not really needed for video, but audio appsrc will not work without it !
-    string pipeStr = "appsrc name=mysrc format=time caps=video/x-raw,format=BGR ! videoconvert ! autovideosink sync=1";
-    GError *err = nullptr;
-    data.pipeline = gst_parse_launch(pipeStr.c_str(), &err);
-    checkErr(err);
-    MY_ASSERT(data.pipeline);
-    // Find our appsrc by name
-    data.srcVideo = gst_bin_get_by_name(GST_BIN (data.pipeline), "mysrc");
-    MY_ASSERT(data.srcVideo);
+    string pipeStr = "appsrc name=mysrc format=time caps=video/x-raw,format=BGR ! videoconvert ! autovideosink name=mysink sync=1";
 
+    // An elf pipeline only, without goblin
     // Important ! We don't want to abuse the appsrc queue
-    // Thus let the pipeline itself signal us when it wants data
-    // This is based on GLib signals
-    g_signal_connect(data.srcVideo, "need-data", G_CALLBACK(startFeed), &data);
-    g_signal_connect(data.srcVideo, "enough-data", G_CALLBACK(stopFeed), &data);
-
-    // Start the bus thread
-    thread threadBus([&data]() -> void {
-        codeThreadBus(data.pipeline, data, "ELF");
-    });
-
-    // Start the appsrc process thread
-    thread threadSrcV([&data]() -> void {
-        codeThreadSrcV(data);
-    });
-
-    // Wait for threads
-    threadBus.join();
-    threadSrcV.join();
-
-    // Destroy the pipeline
-    gst_element_set_state(data.pipeline, GST_STATE_NULL);
-    gst_object_unref(data.pipeline);
+    // The engine lets the pipeline itself signal us when it wants data (need-data, enough-data)
+    BridgeEngine engine("", pipeStr);
+    BridgeStream &streamV = engine.addStream(opts, "", "mysrc", "mysink");
+    streamV.source = [&fileName, depth](BridgeStream &stream) {
+        codeThreadSrcV(stream, fileName, depth);
+    };
+
+    // Play, run until EOS
+    engine.run();
+    engine.printStats();
 
     return 0;
 }
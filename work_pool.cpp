@@ -0,0 +1,113 @@
+//
+// Created by IT-JIM
+// WORK_POOL: Fixed-size work-stealing thread pool, for the sample processing of many streams at once
+
+#include <algorithm>
+
+#include "clock_ns.h"
+#include "work_pool.h"
+
+/// The pool and the worker index of the current thread, if it is a pool worker
+static thread_local WorkPool *tlsPool = nullptr;
+static thread_local int tlsIndex = -1;
+
+//======================================================================================================================
+WorkPool::WorkPool(int numThreads) {
+    if (numThreads <= 0)
+        numThreads = std::max(1, (int) std::thread::hardware_concurrency());
+    for (int i = 0; i < numThreads; ++i)
+        workers.emplace_back(new Worker);
+    // Start the threads only when all workers exist, they steal from each other
+    for (int i = 0; i < numThreads; ++i)
+        workers[i]->thread = std::thread([this, i]{
+            codeThreadWorker(i);
+        });
+}
+
+//======================================================================================================================
+WorkPool::~WorkPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutexIdle);
+        flagStop = true;
+    }
+    condIdle.notify_all();
+    for (auto &w : workers)
+        w->thread.join();
+}
+
+//======================================================================================================================
+void WorkPool::submit(std::function<void()> task) {
+    int index = tlsPool == this ? tlsIndex : int(nextWorker++ % workers.size());
+    {
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->tasks.push_back(std::move(task));
+    }
+    ++countQueued;
+    {
+        // Empty critical section: a worker between its check and its wait cannot miss the notification
+        std::lock_guard<std::mutex> lock(mutexIdle);
+    }
+    condIdle.notify_one();
+}
+
+//======================================================================================================================
+WorkPool::Stats WorkPool::stats() const {
+    Stats s;
+    for (auto &w : workers) {
+        s.countTasks += w->countTasks;
+        s.countSteals += w->countSteals;
+        s.busyNs += w->busyNs;
+    }
+    return s;
+}
+
+//======================================================================================================================
+bool WorkPool::takeTask(int index, std::function<void()> &task) {
+    {
+        Worker &own = *workers[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+            --countQueued;
+            return true;
+        }
+    }
+    // Steal from the others, starting from the next one, so that the thieves spread out
+    int n = (int) workers.size();
+    for (int k = 1; k < n; ++k) {
+        Worker &victim = *workers[(index + k) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            --countQueued;
+            ++workers[index]->countSteals;
+            return true;
+        }
+    }
+    return false;
+}
+
+//======================================================================================================================
+void WorkPool::codeThreadWorker(int index) {
+    tlsPool = this;
+    tlsIndex = index;
+    Worker &self = *workers[index];
+    std::function<void()> task;
+    for (;;) {
+        if (takeTask(index, task)) {
+            int64_t t0 = nowNs();
+            task();
+            task = nullptr;
+            self.busyNs += nowNs() - t0;
+            ++self.countTasks;
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutexIdle);
+        condIdle.wait(lock, [this]{ return countQueued > 0 || flagStop; });
+        // On stop, we still finish all the queued tasks
+        if (flagStop && countQueued == 0)
+            break;
+    }
+}
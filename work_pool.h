@@ -0,0 +1,72 @@
+//
+// Created by IT-JIM
+// WORK_POOL: Fixed-size work-stealing thread pool, for the sample processing of many streams at once
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+//======================================================================================================================
+/// Work-stealing pool: each worker has its own task deque, an idle worker steals from the others
+/// Tasks submitted by a worker go to its own deque (no contention), other threads spread them round-robin
+/// Tasks must not block for long (e.g. wait for need-data), or they hold a worker that other streams need
+class WorkPool {
+public:
+    /// numThreads = 0 : one thread per core
+    explicit WorkPool(int numThreads = 0);
+
+    /// Finishes all queued tasks, then stops the workers
+    ~WorkPool();
+
+    WorkPool(const WorkPool &) = delete;
+
+    WorkPool &operator=(const WorkPool &) = delete;
+
+    void submit(std::function<void()> task);
+
+    int size() const { return (int) workers.size(); }
+
+    /// Statistics of one worker: tasks run, tasks stolen from other workers, time spent in tasks
+    struct Stats {
+        int64_t countTasks = 0;
+        int64_t countSteals = 0;
+        int64_t busyNs = 0;
+    };
+
+    /// Sum over all workers
+    Stats stats() const;
+
+private:
+    struct Worker {
+        /// Protects tasks
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+        std::thread thread;
+
+        std::atomic<int64_t> countTasks{0};
+        std::atomic<int64_t> countSteals{0};
+        std::atomic<int64_t> busyNs{0};
+    };
+
+    /// Take a task from our own deque (front, FIFO), or steal one from another worker (back)
+    bool takeTask(int index, std::function<void()> &task);
+
+    void codeThreadWorker(int index);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    /// Tasks queued in all deques, idle workers sleep while it's 0
+    std::atomic<int64_t> countQueued{0};
+    std::mutex mutexIdle;
+    std::condition_variable condIdle;
+    bool flagStop = false;
+    /// Round-robin target for the tasks submitted from outside the pool
+    std::atomic<unsigned> nextWorker{0};
+};